@@ -0,0 +1,404 @@
+#include "filesys/buffer-cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Ticks between two passes of the flush daemon. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+/* Most read-ahead requests waiting for the read-ahead daemon. */
+#define RA_QUEUE_SIZE 32
+
+/* A cached sector. */
+struct cache_entry {
+	disk_sector_t sector;               /* Sector held in DATA. */
+	bool valid;                         /* Holds SECTOR at all? */
+	bool dirty;                         /* Newer than the disk? */
+	bool accessed;                      /* Used since the clock passed? */
+	bool busy;                          /* Disk I/O in progress. */
+	bool prefetched;                    /* Read ahead, not yet used. */
+	bool journaled;                     /* Waits for a journal commit. */
+	unsigned pin_cnt;                   /* Readers copying out of DATA. */
+	uint8_t data[DISK_SECTOR_SIZE];     /* Sector contents. */
+};
+
+/* The cache.  CACHE_LOCK protects every entry and the clock hand.
+ * It is dropped during disk I/O; the entry being read or written is
+ * marked busy meanwhile, and anyone who needs it waits on IO_DONE.
+ * It is never held while the caller's buffer is touched, since that
+ * may be user memory whose page fault reads a file through the cache
+ * again: reads copy out of a pinned entry, which is not reused until
+ * unpinned, and writes copy the data in before taking the lock.
+ * A journaled entry holds metadata that must not reach its home
+ * sector before the journal commits it, so it is neither written
+ * back nor evicted until buffer_cache_checkpoint(). */
+static struct cache_entry cache[BUFFER_CACHE_SIZE];
+static size_t clock_hand;
+static struct lock cache_lock;
+static struct condition io_done;
+static size_t journaled_cnt;            /* Entries marked journaled. */
+
+/* Sectors queued for the read-ahead daemon, a ring buffer of
+ * RA_COUNT entries starting at RA_HEAD.  Protected by CACHE_LOCK;
+ * RA_READY is signaled when a sector is queued. */
+static disk_sector_t ra_queue[RA_QUEUE_SIZE];
+static size_t ra_head, ra_count;
+static struct condition ra_ready;
+
+/* Statistics. */
+static long long hit_cnt;               /* Lookups found in the cache. */
+static long long miss_cnt;              /* Lookups that went to disk. */
+static long long writeback_cnt;         /* Dirty sectors written. */
+static long long ra_cnt;                /* Sectors read ahead. */
+static long long ra_hit_cnt;            /* Of those, later used. */
+
+static void flush_daemon (void *aux);
+static void readahead_daemon (void *aux);
+
+/* Initializes the buffer cache and starts its flush daemon. */
+void
+buffer_cache_init (void) {
+	lock_init (&cache_lock);
+	cond_init (&io_done);
+	cond_init (&ra_ready);
+	if (thread_create ("bcache-flush", PRI_DEFAULT, flush_daemon, NULL)
+			== TID_ERROR
+			|| thread_create ("bcache-ra", PRI_DEFAULT, readahead_daemon,
+				NULL) == TID_ERROR)
+		PANIC ("buffer cache: cannot start daemons");
+}
+
+/* Returns the valid entry that holds SECTOR, or NULL if there is
+ * none.  CACHE_LOCK must be held. */
+static struct cache_entry *
+lookup (disk_sector_t sector) {
+	for (size_t i = 0; i < BUFFER_CACHE_SIZE; i++)
+		if (cache[i].valid && cache[i].sector == sector)
+			return &cache[i];
+	return NULL;
+}
+
+/* Writes dirty entry E back to disk, dropping CACHE_LOCK meanwhile.
+ * CACHE_LOCK must be held and E must not be busy. */
+static void
+write_back (struct cache_entry *e) {
+	ASSERT (e->dirty && !e->busy);
+
+	e->busy = true;
+	e->dirty = false;
+	lock_release (&cache_lock);
+	disk_write (filesys_disk, e->sector, e->data);
+	lock_acquire (&cache_lock);
+	e->busy = false;
+	writeback_cnt++;
+	cond_broadcast (&io_done, &cache_lock);
+}
+
+/* Picks an entry to reuse with the clock algorithm: an unused entry
+ * if there is one, otherwise one not accessed since the hand last
+ * passed it.  Returns NULL if every entry is busy.  CACHE_LOCK must be
+ * held. */
+static struct cache_entry *
+pick_victim (void) {
+	for (size_t i = 0; i < 2 * BUFFER_CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[clock_hand];
+
+		clock_hand = (clock_hand + 1) % BUFFER_CACHE_SIZE;
+		if (e->busy || e->journaled || e->pin_cnt > 0)
+			continue;
+		if (!e->valid)
+			return e;
+		if (e->accessed) {
+			e->accessed = false;
+			continue;
+		}
+		return e;
+	}
+	return NULL;
+}
+
+/* Returns the entry for SECTOR, loading it first if it is not
+ * cached.  If FILL is false the caller is about to overwrite the
+ * whole sector, so a miss does not read the disk.  PREFETCH is true
+ * for the read-ahead daemon: a sector it loads enters the cache as
+ * not yet accessed, so if it is never used the clock takes it before
+ * anything that was.  The entry is not busy on return.  CACHE_LOCK
+ * must be held. */
+static struct cache_entry *
+get_entry (disk_sector_t sector, bool fill, bool prefetch) {
+	for (;;) {
+		struct cache_entry *e = lookup (sector);
+
+		if (e != NULL) {
+			if (e->busy) {
+				cond_wait (&io_done, &cache_lock);
+				continue;
+			}
+			if (prefetch)
+				return e;
+			if (e->prefetched) {
+				e->prefetched = false;
+				ra_hit_cnt++;
+			}
+			e->accessed = true;
+			hit_cnt++;
+			return e;
+		}
+
+		e = pick_victim ();
+		if (e == NULL) {
+			cond_wait (&io_done, &cache_lock);
+			continue;
+		}
+		if (e->dirty) {
+			/* The lock was dropped, so SECTOR may have been loaded
+			 * by someone else meanwhile: look again. */
+			write_back (e);
+			continue;
+		}
+
+		if (prefetch)
+			ra_cnt++;
+		else
+			miss_cnt++;
+		e->sector = sector;
+		e->valid = true;
+		e->accessed = !prefetch;
+		e->prefetched = prefetch;
+		if (fill) {
+			e->busy = true;
+			lock_release (&cache_lock);
+			disk_read (filesys_disk, sector, e->data);
+			lock_acquire (&cache_lock);
+			e->busy = false;
+			cond_broadcast (&io_done, &cache_lock);
+		}
+		return e;
+	}
+}
+
+/* Reads SIZE bytes starting at byte SECTOR_OFS of SECTOR into
+ * BUFFER, through the cache. */
+void
+buffer_cache_read (disk_sector_t sector, void *buffer, int sector_ofs,
+		int size) {
+	struct cache_entry *e;
+
+	ASSERT (sector_ofs >= 0 && size >= 0);
+	ASSERT (sector_ofs + size <= DISK_SECTOR_SIZE);
+
+	lock_acquire (&cache_lock);
+	e = get_entry (sector, true, false);
+	e->pin_cnt++;
+	lock_release (&cache_lock);
+
+	memcpy (buffer, e->data + sector_ofs, size);
+
+	lock_acquire (&cache_lock);
+	if (--e->pin_cnt == 0)
+		cond_broadcast (&io_done, &cache_lock);
+	lock_release (&cache_lock);
+}
+
+/* Writes SIZE bytes from BUFFER, or zeros if BUFFER is null, to
+ * byte SECTOR_OFS of SECTOR in the cache and marks it dirty, and
+ * journaled too if JOURNALED. */
+static void
+cache_write (disk_sector_t sector, const void *buffer, int sector_ofs,
+		int size, bool journaled) {
+	uint8_t bounce[DISK_SECTOR_SIZE];
+	struct cache_entry *e;
+
+	ASSERT (sector_ofs >= 0 && size >= 0);
+	ASSERT (sector_ofs + size <= DISK_SECTOR_SIZE);
+
+	if (buffer != NULL)
+		memcpy (bounce, buffer, size);
+
+	lock_acquire (&cache_lock);
+	e = get_entry (sector, size < DISK_SECTOR_SIZE, false);
+	if (buffer != NULL)
+		memcpy (e->data + sector_ofs, bounce, size);
+	else
+		memset (e->data + sector_ofs, 0, size);
+	e->dirty = true;
+	if (journaled && !e->journaled) {
+		/* journal_begin() lets a handle in only if there is room for
+		 * it, see there. */
+		ASSERT (journaled_cnt < BUFFER_CACHE_JOURNALED_MAX);
+		e->journaled = true;
+		journaled_cnt++;
+	}
+	lock_release (&cache_lock);
+}
+
+/* Writes SIZE bytes from BUFFER to byte SECTOR_OFS of SECTOR.  The
+ * cached copy is updated and marked dirty; it reaches the disk when
+ * evicted or flushed. */
+void
+buffer_cache_write (disk_sector_t sector, const void *buffer,
+		int sector_ofs, int size) {
+	cache_write (sector, buffer, sector_ofs, size, false);
+}
+
+/* Sets SECTOR to all zeros in the cache, without reading it. */
+void
+buffer_cache_zero (disk_sector_t sector) {
+	cache_write (sector, NULL, 0, DISK_SECTOR_SIZE, false);
+}
+
+/* Like buffer_cache_write(), for metadata that the journal has to
+ * commit before it may reach SECTOR itself. */
+void
+buffer_cache_write_journaled (disk_sector_t sector, const void *buffer,
+		int sector_ofs, int size) {
+	cache_write (sector, buffer, sector_ofs, size, true);
+}
+
+/* Like buffer_cache_zero(), for metadata. */
+void
+buffer_cache_zero_journaled (disk_sector_t sector) {
+	cache_write (sector, NULL, 0, DISK_SECTOR_SIZE, true);
+}
+
+/* Stores up to MAX journaled sectors into SECTORS and returns how
+ * many there are in all. */
+size_t
+buffer_cache_journaled (disk_sector_t *sectors, size_t max) {
+	size_t cnt = 0;
+
+	lock_acquire (&cache_lock);
+	for (size_t i = 0; i < BUFFER_CACHE_SIZE; i++)
+		if (cache[i].journaled) {
+			if (cnt < max)
+				sectors[cnt] = cache[i].sector;
+			cnt++;
+		}
+	ASSERT (cnt == journaled_cnt);
+	lock_release (&cache_lock);
+	return cnt;
+}
+
+/* Writes every journaled sector to its home on disk, now that the
+ * journal has committed it, and lets the cache treat it as ordinary
+ * again. */
+void
+buffer_cache_checkpoint (void) {
+	lock_acquire (&cache_lock);
+	for (size_t i = 0; i < BUFFER_CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[i];
+
+		while (e->busy)
+			cond_wait (&io_done, &cache_lock);
+		if (e->journaled) {
+			e->journaled = false;
+			journaled_cnt--;
+			if (e->dirty)
+				write_back (e);
+		}
+	}
+	lock_release (&cache_lock);
+}
+
+/* Writes every dirty sector back to disk, in ascending sector order
+ * so that runs of adjacent sectors go out as one sweep of the disk
+ * head instead of in whatever order the cache holds them. */
+void
+buffer_cache_flush (void) {
+	disk_sector_t dirty[BUFFER_CACHE_SIZE];
+	size_t dirty_cnt = 0;
+
+	lock_acquire (&cache_lock);
+	for (size_t i = 0; i < BUFFER_CACHE_SIZE; i++)
+		if (cache[i].valid && cache[i].dirty && !cache[i].journaled) {
+			/* Insertion sort: there are at most BUFFER_CACHE_SIZE. */
+			size_t j = dirty_cnt++;
+
+			for (; j > 0 && dirty[j - 1] > cache[i].sector; j--)
+				dirty[j] = dirty[j - 1];
+			dirty[j] = cache[i].sector;
+		}
+
+	/* Entries may change while the lock is dropped for each write, so
+	 * each sector is looked up again. */
+	for (size_t i = 0; i < dirty_cnt; i++) {
+		struct cache_entry *e;
+
+		while ((e = lookup (dirty[i])) != NULL && e->busy)
+			cond_wait (&io_done, &cache_lock);
+		if (e != NULL && e->dirty && !e->journaled)
+			write_back (e);
+	}
+
+	/* Let writes that evictions started finish, too. */
+	for (size_t i = 0; i < BUFFER_CACHE_SIZE; i++)
+		while (cache[i].busy)
+			cond_wait (&io_done, &cache_lock);
+	lock_release (&cache_lock);
+}
+
+/* Asks the read-ahead daemon to bring SECTOR into the cache, and
+ * returns without waiting.  The request is dropped if the sector is
+ * already cached or queued, or if the queue is full. */
+void
+buffer_cache_prefetch (disk_sector_t sector) {
+	lock_acquire (&cache_lock);
+	if (lookup (sector) == NULL && ra_count < RA_QUEUE_SIZE) {
+		for (size_t i = 0; i < ra_count; i++)
+			if (ra_queue[(ra_head + i) % RA_QUEUE_SIZE] == sector)
+				goto done;
+		ra_queue[(ra_head + ra_count++) % RA_QUEUE_SIZE] = sector;
+		cond_signal (&ra_ready, &cache_lock);
+	}
+done:
+	lock_release (&cache_lock);
+}
+
+/* Reads queued sectors into the cache, oldest request first. */
+static void
+readahead_daemon (void *aux UNUSED) {
+	lock_acquire (&cache_lock);
+	for (;;) {
+		disk_sector_t sector;
+
+		while (ra_count == 0)
+			cond_wait (&ra_ready, &cache_lock);
+		sector = ra_queue[ra_head];
+		ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+		ra_count--;
+		get_entry (sector, true, true);
+	}
+}
+
+/* Flushes the cache at shutdown. */
+void
+buffer_cache_done (void) {
+	buffer_cache_flush ();
+}
+
+/* Writes dirty sectors back every FLUSH_INTERVAL ticks, so that a
+ * crash loses at most that much work.  Appended data whose blocks are
+ * still delayed gets them first, so it ages no longer than that
+ * either. */
+static void
+flush_daemon (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (FLUSH_INTERVAL);
+		inode_flush_delayed ();
+		buffer_cache_flush ();
+	}
+}
+
+/* Prints buffer cache statistics. */
+void
+buffer_cache_print_stats (void) {
+	printf ("Buffer cache: %lld hits, %lld misses, %lld sectors written back\n",
+			hit_cnt, miss_cnt, writeback_cnt);
+	printf ("Buffer cache: %lld sectors read ahead, %lld of them used\n",
+			ra_cnt, ra_hit_cnt);
+}
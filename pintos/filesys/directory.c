@@ -1,10 +1,12 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
@@ -19,10 +21,173 @@ struct dir_entry {
 	bool in_use;                        /* In use or free? */
 };
 
+/* In-memory index of a directory's entries, built the first time the
+ * directory is searched and kept with its inode while that stays
+ * open, so every opener shares it.  dir_add() and dir_remove() update
+ * it along with the entries on disk, so lookups never read the
+ * directory again. */
+struct dir_index {
+	struct hash names;                  /* struct dir_slot, keyed on name. */
+	size_t free_cnt;                    /* Free slots before END. */
+	off_t free_hint;                    /* No free slot lies before this. */
+	off_t end;                          /* Offset just past the last slot. */
+};
+
+/* An entry in use, as recorded in a dir_index. */
+struct dir_slot {
+	struct hash_elem elem;              /* Element in dir_index NAMES. */
+	char name[NAME_MAX + 1];            /* Null terminated file name. */
+	disk_sector_t inode_sector;         /* Sector number of header. */
+	off_t ofs;                          /* Byte offset of the entry. */
+};
+
+/* Entries read at once while building an index. */
+#define INDEX_BATCH 32
+
+/* Most names the dentry cache remembers. */
+#define DCACHE_SIZE 256
+
+/* A name looked up in some directory, as remembered by the dentry
+ * cache.  Unlike a dir_index, which lives only while its directory is
+ * open, the cache outlasts the directory, so a path opened again and
+ * again does not rebuild the index of every directory on the way.
+ * A negative dentry records that the name does not exist. */
+struct dentry {
+	struct hash_elem elem;              /* Element in DCACHE. */
+	struct list_elem lru_elem;          /* Element in DCACHE_LRU. */
+	disk_sector_t parent;               /* Sector of the directory. */
+	char name[NAME_MAX + 1];            /* Null terminated file name. */
+	bool negative;                      /* NAME known not to exist? */
+	disk_sector_t inode_sector;         /* Sector number of header. */
+};
+
+/* The dentry cache, with the least recently used dentry at the front
+ * of DCACHE_LRU.  Both are protected by DCACHE_LOCK. */
+static struct hash dcache;
+static struct list dcache_lru;
+static struct lock dcache_lock;
+
+/* Returns a hash value for the dentry that E is embedded in. */
+static uint64_t
+dentry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct dentry *d = hash_entry (e, struct dentry, elem);
+
+	return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+/* Orders dentries by directory, then by name. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct dentry *a = hash_entry (a_, struct dentry, elem);
+	const struct dentry *b = hash_entry (b_, struct dentry, elem);
+
+	if (a->parent != b->parent)
+		return a->parent < b->parent;
+	return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the dentry cache. */
+void
+dir_init (void) {
+	if (!hash_init (&dcache, dentry_hash, dentry_less, NULL))
+		PANIC ("dentry cache: out of memory");
+	list_init (&dcache_lru);
+	lock_init (&dcache_lock);
+}
+
+/* Returns the dentry for NAME in the directory at sector PARENT, or
+ * a null pointer if none is cached.  DCACHE_LOCK must be held. */
+static struct dentry *
+dcache_find (disk_sector_t parent, const char *name) {
+	struct dentry key;
+	struct hash_elem *e;
+
+	key.parent = parent;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&dcache, &key.elem);
+	return e != NULL ? hash_entry (e, struct dentry, elem) : NULL;
+}
+
+/* Looks NAME up in the directory at sector PARENT in the dentry
+ * cache.  On a hit, returns true and sets *NEGATIVE and, for a name
+ * that exists, *INODE_SECTOR. */
+static bool
+dcache_get (disk_sector_t parent, const char *name, bool *negative,
+		disk_sector_t *inode_sector) {
+	struct dentry *d;
+
+	lock_acquire (&dcache_lock);
+	d = dcache_find (parent, name);
+	if (d != NULL) {
+		list_remove (&d->lru_elem);
+		list_push_back (&dcache_lru, &d->lru_elem);
+		*negative = d->negative;
+		*inode_sector = d->inode_sector;
+	}
+	lock_release (&dcache_lock);
+	return d != NULL;
+}
+
+/* Remembers that NAME in the directory at sector PARENT refers to
+ * INODE_SECTOR, or that it does not exist if NEGATIVE.  Forgets the
+ * least recently used dentry if the cache is full.  Gives up quietly
+ * if out of memory: the cache is only a hint. */
+static void
+dcache_put (disk_sector_t parent, const char *name, bool negative,
+		disk_sector_t inode_sector) {
+	struct dentry *d;
+
+	lock_acquire (&dcache_lock);
+	d = dcache_find (parent, name);
+	if (d != NULL)
+		list_remove (&d->lru_elem);
+	else {
+		if (hash_size (&dcache) >= DCACHE_SIZE) {
+			d = list_entry (list_pop_front (&dcache_lru), struct dentry,
+					lru_elem);
+			hash_delete (&dcache, &d->elem);
+		} else
+			d = malloc (sizeof *d);
+		if (d == NULL)
+			goto done;
+		d->parent = parent;
+		strlcpy (d->name, name, sizeof d->name);
+		hash_insert (&dcache, &d->elem);
+	}
+	d->negative = negative;
+	d->inode_sector = inode_sector;
+	list_push_back (&dcache_lru, &d->lru_elem);
+done:
+	lock_release (&dcache_lock);
+}
+
+/* Forgets every dentry for names in the directory at sector PARENT.
+ * Used when a new directory is created there, since the sector may
+ * have held a directory that was removed. */
+static void
+dcache_purge (disk_sector_t parent) {
+	struct list_elem *e;
+
+	lock_acquire (&dcache_lock);
+	for (e = list_begin (&dcache_lru); e != list_end (&dcache_lru);) {
+		struct dentry *d = list_entry (e, struct dentry, lru_elem);
+
+		e = list_next (e);
+		if (d->parent == parent) {
+			list_remove (&d->lru_elem);
+			hash_delete (&dcache, &d->elem);
+			free (d);
+		}
+	}
+	lock_release (&dcache_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) {
+	dcache_purge (sector);
 	return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
 }
 
@@ -32,6 +197,7 @@ struct dir *
 dir_open (struct inode *inode) {
 	struct dir *dir = calloc (1, sizeof *dir);
 	if (inode != NULL && dir != NULL) {
+		inode_set_journaled (inode);
 		dir->inode = inode;
 		dir->pos = 0;
 		return dir;
@@ -71,30 +237,151 @@ dir_get_inode (struct dir *dir) {
 	return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
- * If successful, returns true, sets *EP to the directory entry
- * if EP is non-null, and sets *OFSP to the byte offset of the
- * directory entry if OFSP is non-null.
- * otherwise, returns false and ignores EP and OFSP. */
+/* Returns a hash value for the dir_slot that E is embedded in. */
+static uint64_t
+slot_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_string (hash_entry (e, struct dir_slot, elem)->name);
+}
+
+/* Orders dir_slots by name. */
 static bool
-lookup (const struct dir *dir, const char *name,
-		struct dir_entry *ep, off_t *ofsp) {
-	struct dir_entry e;
-	size_t ofs;
+slot_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return strcmp (hash_entry (a, struct dir_slot, elem)->name,
+			hash_entry (b, struct dir_slot, elem)->name) < 0;
+}
+
+/* hash_destroy() action that frees one dir_slot. */
+static void
+slot_free (struct hash_elem *e, void *aux UNUSED) {
+	free (hash_entry (e, struct dir_slot, elem));
+}
+
+/* Frees dir_index INDEX.  Called when the directory's inode is
+ * closed for the last time. */
+static void
+index_free (void *index_) {
+	struct dir_index *index = index_;
+
+	hash_destroy (&index->names, slot_free);
+	free (index);
+}
+
+/* Records the entry in use NAME -> INODE_SECTOR at OFS in INDEX.
+ * Returns false if out of memory. */
+static bool
+index_insert (struct dir_index *index, const char *name,
+		disk_sector_t inode_sector, off_t ofs) {
+	struct dir_slot *slot = malloc (sizeof *slot);
+
+	if (slot == NULL)
+		return false;
+	strlcpy (slot->name, name, sizeof slot->name);
+	slot->inode_sector = inode_sector;
+	slot->ofs = ofs;
+	hash_insert (&index->names, &slot->elem);
+	return true;
+}
+
+/* Returns DIR's index, reading the whole directory to build it if
+ * this is the first time.  Returns a null pointer if out of memory. */
+static struct dir_index *
+get_index (const struct dir *dir) {
+	struct dir_index *index = inode_get_private (dir->inode);
+	struct dir_entry *batch;
+	off_t ofs = 0, bytes;
+
+	if (index != NULL)
+		return index;
+
+	index = malloc (sizeof *index);
+	batch = malloc (INDEX_BATCH * sizeof *batch);
+	if (index == NULL || batch == NULL || !hash_init (&index->names,
+				slot_hash, slot_less, NULL)) {
+		free (index);
+		free (batch);
+		return NULL;
+	}
+	index->free_cnt = 0;
+	index->free_hint = -1;
+
+	/* inode_read_at() will only return a short read at end of file;
+	 * a trailing partial entry is ignored, as before. */
+	while ((bytes = inode_read_at (dir->inode, batch, sizeof *batch
+					* INDEX_BATCH, ofs)) >= (off_t) sizeof *batch) {
+		size_t cnt = bytes / sizeof *batch;
+
+		for (size_t i = 0; i < cnt; i++, ofs += sizeof *batch) {
+			if (!batch[i].in_use) {
+				if (index->free_cnt++ == 0)
+					index->free_hint = ofs;
+			} else if (!index_insert (index, batch[i].name,
+						batch[i].inode_sector, ofs)) {
+				index_free (index);
+				free (batch);
+				return NULL;
+			}
+		}
+		if (cnt < INDEX_BATCH)
+			break;
+	}
+	free (batch);
+
+	index->end = ofs;
+	if (index->free_cnt == 0)
+		index->free_hint = ofs;
+	inode_set_private (dir->inode, index, index_free);
+	return index;
+}
+
+/* Searches DIR for a file with the given NAME.
+ * Returns its slot in DIR's index, or a null pointer if there is no
+ * such file or the index cannot be built. */
+static struct dir_slot *
+lookup (const struct dir *dir, const char *name) {
+	struct dir_index *index;
+	struct dir_slot key;
+	struct hash_elem *e;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (e.in_use && !strcmp (name, e.name)) {
-			if (ep != NULL)
-				*ep = e;
-			if (ofsp != NULL)
-				*ofsp = ofs;
-			return true;
-		}
-	return false;
+	index = get_index (dir);
+	if (index == NULL || strlen (name) > NAME_MAX)
+		return NULL;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&index->names, &key.elem);
+	return e != NULL ? hash_entry (e, struct dir_slot, elem) : NULL;
+}
+
+/* Returns the offset of a free slot in DIR, which has index INDEX,
+ * and takes it out of the free count.  The slots before the hint
+ * are known to be in use; at most the slots from the hint up to the
+ * first free one are read.  With no free slot left, returns the end
+ * of the directory. */
+static off_t
+take_free_slot (struct dir *dir, struct dir_index *index) {
+	struct dir_entry e;
+	off_t ofs;
+
+	if (index->free_cnt == 0)
+		return index->end;
+
+	for (ofs = index->free_hint; ofs < index->end; ofs += sizeof e)
+		if (inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e
+				&& !e.in_use)
+			break;
+	ASSERT (ofs < index->end);
+	index->free_cnt--;
+	index->free_hint = ofs + sizeof e;
+	return ofs;
+}
+
+/* Counts the slot at OFS as free again in INDEX. */
+static void
+put_free_slot (struct dir_index *index, off_t ofs) {
+	if (index->free_cnt++ == 0 || ofs < index->free_hint)
+		index->free_hint = ofs;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -104,15 +391,29 @@ lookup (const struct dir *dir, const char *name,
 bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
-	struct dir_entry e;
+	disk_sector_t parent, inode_sector;
+	struct dir_slot *slot;
+	bool negative;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
-		*inode = inode_open (e.inode_sector);
-	else
-		*inode = NULL;
+	*inode = NULL;
+	if (*name == '\0' || strlen (name) > NAME_MAX)
+		return false;
+
+	parent = inode_get_inumber (dir->inode);
+	if (!dcache_get (parent, name, &negative, &inode_sector)) {
+		/* Without an index, a miss would say nothing. */
+		if (get_index (dir) == NULL)
+			return false;
+		slot = lookup (dir, name);
+		negative = slot == NULL;
+		inode_sector = negative ? 0 : slot->inode_sector;
+		dcache_put (parent, name, negative, inode_sector);
+	}
+	if (!negative)
+		*inode = inode_open (inode_sector);
 
 	return *inode != NULL;
 }
@@ -125,9 +426,9 @@ dir_lookup (const struct dir *dir, const char *name,
  * error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
+	struct dir_index *index;
 	struct dir_entry e;
 	off_t ofs;
-	bool success = false;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
@@ -137,29 +438,38 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 		return false;
 
 	/* Check that NAME is not in use. */
-	if (lookup (dir, name, NULL, NULL))
-		goto done;
+	index = get_index (dir);
+	if (index == NULL || lookup (dir, name) != NULL)
+		return false;
 
 	/* Set OFS to offset of free slot.
 	 * If there are no free slots, then it will be set to the
-	 * current end-of-file.
-
-	 * inode_read_at() will only return a short read at end of file.
-	 * Otherwise, we'd need to verify that we didn't get a short
-	 * read due to something intermittent such as low memory. */
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (!e.in_use)
-			break;
+	 * current end-of-file. */
+	ofs = take_free_slot (dir, index);
 
 	/* Write slot. */
 	e.in_use = true;
 	strlcpy (e.name, name, sizeof e.name);
 	e.inode_sector = inode_sector;
-	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-
-done:
-	return success;
+	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) {
+		if (ofs < index->end)
+			put_free_slot (index, ofs);
+		return false;
+	}
+	if (ofs == index->end)
+		index->end += sizeof e;
+	if (!index_insert (index, name, inode_sector, ofs)) {
+		/* Out of memory: free the slot again so the index still
+		 * matches the disk. */
+		e.in_use = false;
+		inode_write_at (dir->inode, &e, sizeof e, ofs);
+		put_free_slot (index, ofs);
+		return false;
+	}
+	if (index->free_cnt == 0)
+		index->free_hint = index->end;
+	dcache_put (inode_get_inumber (dir->inode), name, false, inode_sector);
+	return true;
 }
 
 /* Removes any entry for NAME in DIR.
@@ -167,28 +477,39 @@ done:
  * which occurs only if there is no file with the given NAME. */
 bool
 dir_remove (struct dir *dir, const char *name) {
+	struct dir_index *index;
+	struct dir_slot *slot;
 	struct dir_entry e;
 	struct inode *inode = NULL;
 	bool success = false;
-	off_t ofs;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
 	/* Find directory entry. */
-	if (!lookup (dir, name, &e, &ofs))
+	slot = lookup (dir, name);
+	if (slot == NULL)
 		goto done;
 
 	/* Open inode. */
-	inode = inode_open (e.inode_sector);
+	inode = inode_open (slot->inode_sector);
 	if (inode == NULL)
 		goto done;
 
 	/* Erase directory entry. */
 	e.in_use = false;
-	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+	strlcpy (e.name, slot->name, sizeof e.name);
+	e.inode_sector = slot->inode_sector;
+	if (inode_write_at (dir->inode, &e, sizeof e, slot->ofs) != sizeof e)
 		goto done;
 
+	/* Forget it in the index; its slot is free now. */
+	index = inode_get_private (dir->inode);
+	hash_delete (&index->names, &slot->elem);
+	put_free_slot (index, slot->ofs);
+	free (slot);
+	dcache_put (inode_get_inumber (dir->inode), name, true, 0);
+
 	/* Remove inode. */
 	inode_remove (inode);
 	success = true;
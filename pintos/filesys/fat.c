@@ -1,6 +1,10 @@
 #include "filesys/fat.h"
+#include <bitmap.h>
+#include <round.h>
 #include "devices/disk.h"
+#include "filesys/buffer-cache.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include <stdio.h>
@@ -16,13 +20,22 @@ struct fat_boot {
 	unsigned int root_dir_cluster;
 };
 
-/* FAT FS */
+/* FAT FS
+ * The whole FAT is kept in memory.  FREE_MAP has a bit per cluster,
+ * set if the cluster is in use, so allocation does not scan the FAT
+ * itself; FREE_CNT lets a full disk be detected at once.  DIRTY has a
+ * bit per FAT sector changed since it was last written, so that only
+ * those are written back.  WRITE_LOCK protects the FAT and all three. */
 struct fat_fs {
 	struct fat_boot bs;
 	unsigned int *fat;
 	unsigned int fat_length;
 	disk_sector_t data_start;
-	cluster_t last_clst;
+	cluster_t last_clst;              /* Next-fit hint: last cluster
+	                                     allocated. */
+	struct bitmap *free_map;          /* Clusters in use. */
+	size_t free_cnt;                  /* Clusters not in use. */
+	struct bitmap *dirty;             /* FAT sectors not yet written. */
 	struct lock write_lock;
 };
 
@@ -31,11 +44,18 @@ static struct fat_fs *fat_fs;
 void fat_boot_create (void);
 void fat_fs_init (void);
 
+/* FAT entries per FAT sector. */
+#define ENTRIES_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (cluster_t))
+
+/* Statistics. */
+static long long fat_write_cnt;       /* FAT sectors written back. */
+
 void
 fat_init (void) {
 	fat_fs = calloc (1, sizeof (struct fat_fs));
 	if (fat_fs == NULL)
 		PANIC ("FAT init failed");
+	lock_init (&fat_fs->write_lock);
 
 	// Read boot sector from the disk
 	unsigned int *bounce = malloc (DISK_SECTOR_SIZE);
@@ -51,33 +71,35 @@ fat_init (void) {
 	fat_fs_init ();
 }
 
+/* Allocates an empty in-memory FAT.  It covers whole FAT sectors, so
+ * each can be read or written in place. */
+static void
+fat_alloc_table (void) {
+	free (fat_fs->fat);
+	fat_fs->fat = calloc (fat_fs->bs.fat_sectors, DISK_SECTOR_SIZE);
+	if (fat_fs->fat == NULL)
+		PANIC ("FAT allocation failed");
+	fat_fs->free_cnt = fat_fs->fat_length - 1;
+	bitmap_set_all (fat_fs->free_map, false);
+	bitmap_mark (fat_fs->free_map, 0);
+	bitmap_set_all (fat_fs->dirty, false);
+}
+
 void
 fat_open (void) {
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat == NULL)
-		PANIC ("FAT load failed");
+	fat_alloc_table ();
 
 	// Load FAT directly from the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_read = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_read;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i,
-			           buffer + bytes_read);
-			bytes_read += DISK_SECTOR_SIZE;
-		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			memcpy (buffer + bytes_read, bounce, bytes_left);
-			bytes_read += bytes_left;
-			free (bounce);
+	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++)
+		disk_read (filesys_disk, fat_fs->bs.fat_start + i,
+		           (uint8_t *) fat_fs->fat + i * DISK_SECTOR_SIZE);
+
+	// Index the clusters in use
+	for (cluster_t clst = 1; clst < fat_fs->fat_length; clst++)
+		if (fat_fs->fat[clst] != 0) {
+			bitmap_mark (fat_fs->free_map, clst);
+			fat_fs->free_cnt--;
 		}
-	}
 }
 
 void
@@ -90,27 +112,8 @@ fat_close (void) {
 	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
 	free (bounce);
 
-	// Write FAT directly to the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
-		}
-	}
+	// Write back the FAT sectors that changed
+	fat_flush ();
 }
 
 void
@@ -119,20 +122,21 @@ fat_create (void) {
 	fat_boot_create ();
 	fat_fs_init ();
 
-	// Create FAT table
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat == NULL)
-		PANIC ("FAT creation failed");
+	// Create FAT table.  Every sector is new, so all are written.
+	fat_alloc_table ();
+	bitmap_set_all (fat_fs->dirty, true);
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
 
+	// Set aside the journal region, as one chain
+	for (cluster_t clst = JOURNAL_CLUSTER;
+			clst < JOURNAL_CLUSTER + JOURNAL_SECTORS - 1; clst++)
+		fat_put (clst, clst + 1);
+	fat_put (JOURNAL_CLUSTER + JOURNAL_SECTORS - 1, EOChain);
+
 	// Fill up ROOT_DIR_CLUSTER region with 0
-	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
-	if (buf == NULL)
-		PANIC ("FAT create failed due to OOM");
-	disk_write (filesys_disk, cluster_to_sector (ROOT_DIR_CLUSTER), buf);
-	free (buf);
+	buffer_cache_zero (cluster_to_sector (ROOT_DIR_CLUSTER));
 }
 
 void
@@ -150,44 +154,179 @@ fat_boot_create (void) {
 	};
 }
 
+/* Derives the layout from the boot sector.  Data clusters follow the
+ * FAT; cluster 0 is never used, since a 0 entry marks a free
+ * cluster, so cluster 1 is the first data cluster. */
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	fat_fs->fat_length = (fat_fs->bs.total_sectors - fat_fs->data_start)
+		/ SECTORS_PER_CLUSTER + 1;
+	fat_fs->last_clst = ROOT_DIR_CLUSTER;
+
+	if (fat_fs->free_map != NULL)
+		bitmap_destroy (fat_fs->free_map);
+	if (fat_fs->dirty != NULL)
+		bitmap_destroy (fat_fs->dirty);
+	fat_fs->free_map = bitmap_create (fat_fs->fat_length);
+	fat_fs->dirty = bitmap_create (fat_fs->bs.fat_sectors);
+	if (fat_fs->free_map == NULL || fat_fs->dirty == NULL)
+		PANIC ("FAT init failed");
 }
 
 /*----------------------------------------------------------------------------*/
 /* FAT handling                                                               */
 /*----------------------------------------------------------------------------*/
 
+/* Sets FAT entry CLST to VAL, keeping the free map and the dirty
+ * sector map in step.  WRITE_LOCK must be held. */
+static void
+fat_set (cluster_t clst, cluster_t val) {
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+
+	if ((fat_fs->fat[clst] != 0) != (val != 0)) {
+		bitmap_set (fat_fs->free_map, clst, val != 0);
+		if (val != 0)
+			fat_fs->free_cnt--;
+		else
+			fat_fs->free_cnt++;
+	}
+	fat_fs->fat[clst] = val;
+	bitmap_mark (fat_fs->dirty, clst / ENTRIES_PER_SECTOR);
+}
+
+/* Returns a free cluster, or 0 if there is none.  The cluster right
+ * after PREV is preferred, so that a growing chain stays contiguous;
+ * failing that, the search continues from the last cluster handed
+ * out (next fit), wrapping around once.  WRITE_LOCK must be held. */
+static cluster_t
+fat_find_free (cluster_t prev) {
+	size_t clst;
+
+	if (fat_fs->free_cnt == 0)
+		return 0;
+	if (prev != 0 && prev + 1 < fat_fs->fat_length
+			&& !bitmap_test (fat_fs->free_map, prev + 1))
+		return prev + 1;
+
+	clst = bitmap_scan (fat_fs->free_map, fat_fs->last_clst, 1, false);
+	if (clst == BITMAP_ERROR)
+		clst = bitmap_scan (fat_fs->free_map, 1, 1, false);
+	return clst != BITMAP_ERROR ? clst : 0;
+}
+
 /* Add a cluster to the chain.
  * If CLST is 0, start a new chain.
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	cluster_t new;
+
+	lock_acquire (&fat_fs->write_lock);
+	new = fat_find_free (clst);
+	if (new != 0) {
+		fat_set (new, EOChain);
+		if (clst != 0)
+			fat_set (clst, new);
+		fat_fs->last_clst = new;
+	}
+	lock_release (&fat_fs->write_lock);
+	return new;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		fat_set (pclst, EOChain);
+	while (clst != 0 && clst != EOChain) {
+		cluster_t next = fat_fs->fat[clst];
+		fat_set (clst, 0);
+		clst = next;
+	}
+	lock_release (&fat_fs->write_lock);
+}
+
+/* Stores the disk sectors of up to MAX FAT sectors changed since
+ * they were last written into SECTORS, and returns how many there are
+ * in all. */
+size_t
+fat_dirty_sectors (disk_sector_t *sectors, size_t max) {
+	size_t cnt = 0;
+
+	lock_acquire (&fat_fs->write_lock);
+	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++)
+		if (bitmap_test (fat_fs->dirty, i)) {
+			if (cnt < max)
+				sectors[cnt] = fat_fs->bs.fat_start + i;
+			cnt++;
+		}
+	lock_release (&fat_fs->write_lock);
+	return cnt;
+}
+
+/* Copies FAT sector SECTOR, a disk sector number, from the in-memory
+ * FAT into BUFFER. */
+void
+fat_copy_sector (disk_sector_t sector, void *buffer) {
+	ASSERT (sector >= fat_fs->bs.fat_start
+			&& sector < fat_fs->bs.fat_start + fat_fs->bs.fat_sectors);
+
+	lock_acquire (&fat_fs->write_lock);
+	memcpy (buffer, (uint8_t *) fat_fs->fat
+			+ (sector - fat_fs->bs.fat_start) * DISK_SECTOR_SIZE,
+			DISK_SECTOR_SIZE);
+	lock_release (&fat_fs->write_lock);
+}
+
+/* Writes back the FAT sectors that changed. */
+void
+fat_flush (void) {
+	lock_acquire (&fat_fs->write_lock);
+	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++)
+		if (bitmap_test (fat_fs->dirty, i)) {
+			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
+			            (uint8_t *) fat_fs->fat + i * DISK_SECTOR_SIZE);
+			bitmap_reset (fat_fs->dirty, i);
+			fat_write_cnt++;
+		}
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	fat_set (clst, val);
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
+}
+
+/* Converts a sector number in the data area back to its cluster #. */
+cluster_t
+sector_to_cluster (disk_sector_t sector) {
+	ASSERT (sector >= fat_fs->data_start);
+	return (sector - fat_fs->data_start) / SECTORS_PER_CLUSTER + 1;
+}
+
+/* Prints FAT statistics. */
+void
+fat_print_stats (void) {
+	printf ("FAT: %zu of %u clusters free, %lld FAT sectors written\n",
+			fat_fs->free_cnt, fat_fs->fat_length - 1, fat_write_cnt);
 }
@@ -1,8 +1,14 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/disk.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Range of the number of sectors read ahead for sequential reads. */
+/* 순차 읽기 시 미리 읽을 섹터 수의 범위 */
+#define READAHEAD_MIN 2  /* Window once sequential access is seen. */ /* 순차 접근이 감지된 직후의 윈도우 */
+#define READAHEAD_MAX 16 /* Largest window, 1/4 of the 64-entry buffer cache. */ /* 윈도우 상한 (버퍼 캐시 64칸의 1/4) */
+
 /* An open file. */
 /* 열린 파일을 나타내는 구조체입니다. */
 struct file
@@ -11,8 +17,21 @@ struct file
     off_t pos; /* Current position. */       /* 현재 파일 포인터 위치. */
     bool deny_write;
     /* Has file_deny_write() been called? */ /* file_deny_write()가 호출되었는지 여부. */
+
+    /* Read-ahead state. */ /* 미리 읽기 상태 */
+    off_t ra_next;
+    /* Where the last file_read() ended; a read starting here is sequential. */
+    /* 직전 file_read()가 끝난 위치. 다음 읽기가 여기서 시작하면 순차 접근 */
+    off_t ra_end;
+    /* End, in bytes, of the range already queued for read-ahead. */
+    /* 이미 미리 읽기를 요청한 범위의 끝 (바이트) */
+    int ra_window;
+    /* Sectors to read ahead; 0 means no read-ahead. */
+    /* 미리 읽을 섹터 수. 0이면 미리 읽기 안 함 */
 };
 
+static void file_readahead(struct file *file, off_t ofs);
+
 /* Opens a file for the given INODE, of which it takes ownership,
  * and returns the new file.  Returns a null pointer if an
  * allocation fails or if INODE is null. */
@@ -95,9 +114,44 @@ off_t file_read(struct file *file, void *buffer, off_t size)
     // 현재 파일 위치(file->pos)에서 size 바이트를 읽어 buffer에 저장
     off_t bytes_read = inode_read_at(file->inode, buffer, size, file->pos);
     file->pos += bytes_read;  // 실제로 읽은 바이트 수만큼 파일 포인터 위치 이동
+    file_readahead(file, file->pos - bytes_read);
     return bytes_read;        // 실제로 읽은 바이트 수 반환
 }
 
+/* Queues read-ahead after a read of FILE that started at OFS and
+ * ended at file->pos.  A read that picks up where the last one ended
+ * is sequential and doubles the window, up to READAHEAD_MAX; a read
+ * anywhere else shrinks it to 0.  Sectors already queued are not
+ * queued again, so requests cover only ra_end up to pos plus the
+ * window.  The buffer cache's daemon does the actual reads. */
+/* OFS에서 시작해 file->pos에서 끝난 읽기를 보고 미리 읽기를 요청합니다.
+ * 직전 읽기가 끝난 곳에서 이어 읽으면 순차 접근으로 보고 윈도우를 두 배로
+ * 키우며(최대 READAHEAD_MAX), 다른 곳을 읽으면 윈도우를 0으로 접습니다.
+ * 이미 요청한 섹터는 다시 요청하지 않으므로 요청은 ra_end부터
+ * pos + 윈도우까지만 나갑니다. 실제 읽기는 버퍼 캐시의 데몬이 합니다. */
+static void file_readahead(struct file *file, off_t ofs)
+{
+    off_t ra_limit;
+
+    if (ofs == file->ra_next && ofs != 0)
+        file->ra_window = file->ra_window == 0 ? READAHEAD_MIN
+                          : file->ra_window * 2 > READAHEAD_MAX ? READAHEAD_MAX
+                                                                : file->ra_window * 2;
+    else if (ofs != file->ra_next)
+    {
+        file->ra_window = 0;
+        file->ra_end = 0;
+    }
+    file->ra_next = file->pos;
+
+    if (file->ra_window == 0) return;
+    ra_limit = file->pos + (off_t)file->ra_window * DISK_SECTOR_SIZE;
+    if (file->ra_end < file->pos) file->ra_end = file->pos;
+    if (file->ra_end >= ra_limit) return;
+    inode_readahead(file->inode, file->ra_end, ra_limit - file->ra_end);
+    file->ra_end = ra_limit;
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
  * starting at offset FILE_OFS in the file.
  * Returns the number of bytes actually read,
@@ -115,13 +169,12 @@ off_t file_read_at(struct file *file, void *buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at the file's current position.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk is full.
+ * Writing past end of file extends the file.
  * Advances FILE's position by the number of bytes read. */
 /* 파일의 현재 위치에서 시작하여 BUFFER에서 FILE로 SIZE 바이트를 씁니다.
- * 실제로 쓴 바이트 수를 반환하며, 파일 끝에 도달하면 SIZE보다 작을 수 있습니다.
- * (일반적으로는 그 경우 파일을 확장하지만, 파일 확장은 아직 구현되지 않았습니다.)
+ * 실제로 쓴 바이트 수를 반환하며, 디스크가 가득 차면 SIZE보다 작을 수 있습니다.
+ * 파일 끝을 넘어서 쓰면 파일이 확장됩니다.
  * 읽은 바이트 수만큼 FILE의 위치를 진행시킵니다. */
 off_t file_write(struct file *file, const void *buffer, off_t size)
 {
@@ -134,13 +187,12 @@ off_t file_write(struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at offset FILE_OFS in the file.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk is full.
+ * Writing past end of file extends the file.
  * The file's current position is unaffected. */
 /* 파일의 오프셋 FILE_OFS에서 시작하여 BUFFER에서 FILE로 SIZE 바이트를 씁니다.
- * 실제로 쓴 바이트 수를 반환하며, 파일 끝에 도달하면 SIZE보다 작을 수 있습니다.
- * (일반적으로는 그 경우 파일을 확장하지만, 파일 확장은 아직 구현되지 않았습니다.)
+ * 실제로 쓴 바이트 수를 반환하며, 디스크가 가득 차면 SIZE보다 작을 수 있습니다.
+ * 파일 끝을 넘어서 쓰면 파일이 확장됩니다.
  * 파일의 현재 위치는 영향을 받지 않습니다. */
 off_t file_write_at(struct file *file, const void *buffer, off_t size, off_t file_ofs)
 {
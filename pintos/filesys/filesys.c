@@ -2,10 +2,12 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/buffer-cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 #include "devices/disk.h"
 
 /* The disk that contains the file system. */
@@ -21,7 +23,9 @@ filesys_init (bool format) {
 	if (filesys_disk == NULL)
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+	buffer_cache_init ();
 	inode_init ();
+	dir_init ();
 
 #ifdef EFILESYS
 	fat_init ();
@@ -29,6 +33,7 @@ filesys_init (bool format) {
 	if (format)
 		do_format ();
 
+	journal_init (format);
 	fat_open ();
 #else
 	/* Original FS */
@@ -37,6 +42,7 @@ filesys_init (bool format) {
 	if (format)
 		do_format ();
 
+	journal_init (format);
 	free_map_open ();
 #endif
 }
@@ -45,12 +51,16 @@ filesys_init (bool format) {
  * to disk. */
 void
 filesys_done (void) {
+	inode_flush_delayed ();
+	journal_done ();
+
 	/* Original FS */
 #ifdef EFILESYS
 	fat_close ();
 #else
 	free_map_close ();
 #endif
+	buffer_cache_done ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -61,12 +71,16 @@ bool
 filesys_create (const char *name, off_t initial_size) {
 	disk_sector_t inode_sector = 0;
 	struct dir *dir = dir_open_root ();
-	bool success = (dir != NULL
+	bool success;
+
+	journal_begin ();
+	success = (dir != NULL
 			&& free_map_allocate (1, &inode_sector)
 			&& inode_create (inode_sector, initial_size)
 			&& dir_add (dir, name, inode_sector));
 	if (!success && inode_sector != 0)
 		free_map_release (inode_sector, 1);
+	journal_end ();
 	dir_close (dir);
 
 	return success;
@@ -96,7 +110,18 @@ filesys_open (const char *name) {
 bool
 filesys_remove (const char *name) {
 	struct dir *dir = dir_open_root ();
-	bool success = dir != NULL && dir_remove (dir, name);
+	struct inode *inode = NULL;
+	bool success;
+
+	/* Hold the file open across the handle, so that if this is its
+	 * last opener its blocks are released after the handle, in
+	 * handles of their own. */
+	if (dir != NULL)
+		dir_lookup (dir, name, &inode);
+	journal_begin ();
+	success = dir != NULL && dir_remove (dir, name);
+	journal_end ();
+	inode_close (inode);
 	dir_close (dir);
 
 	return success;
@@ -110,6 +135,8 @@ do_format (void) {
 #ifdef EFILESYS
 	/* Create FAT and save it to the disk. */
 	fat_create ();
+	if (!dir_create (ROOT_DIR_SECTOR, 16))
+		PANIC ("root directory creation failed");
 	fat_close ();
 #else
 	free_map_create ();
@@ -1,13 +1,48 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <list.h>
+#include <round.h>
+#include "filesys/fat.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 
+#ifndef EFILESYS
+/* A run of free sectors. */
+struct free_extent {
+	struct list_elem elem;              /* Element in FREE_EXTENTS. */
+	disk_sector_t start;                /* First free sector. */
+	size_t cnt;                         /* Number of free sectors. */
+};
+
+/* The free sectors as a list of extents, sorted by START, with no two
+ * adjacent.  FREE_MAP stays the authority: if an extent cannot be
+ * allocated, the list goes stale and is rebuilt from the bitmap the
+ * next time it comes up short. */
+static struct list free_extents;
+static bool extents_stale;
+
+/* Free sectors, and how many of them are promised to callers of
+ * free_map_reserve().  Other allocations may only take the rest. */
+static size_t free_cnt;
+static size_t reserved_cnt;
+
+/* Sectors of the free map file that differ from the disk, one bit
+ * each, and the lock that protects the free map and everything
+ * above. */
+static struct bitmap *dirty_sectors;
+static struct lock free_map_lock;
+
+static void build_extents (void);
+#endif
+
 /* Initializes the free map. */
 void
 free_map_init (void) {
@@ -16,6 +51,226 @@ free_map_init (void) {
 		PANIC ("bitmap creation failed--disk is too large");
 	bitmap_mark (free_map, FREE_MAP_SECTOR);
 	bitmap_mark (free_map, ROOT_DIR_SECTOR);
+#ifndef EFILESYS
+	bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+	dirty_sectors = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+				DISK_SECTOR_SIZE));
+	if (dirty_sectors == NULL)
+		PANIC ("bitmap creation failed--disk is too large");
+	list_init (&free_extents);
+	lock_init (&free_map_lock);
+	build_extents ();
+#endif
+}
+
+#ifdef EFILESYS
+/* With the FAT file system the FAT does the bookkeeping: each sector
+ * handed out is a one-cluster chain of its own.  Only single sectors
+ * are asked for. */
+bool
+free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
+	cluster_t clst;
+
+	ASSERT (cnt == 1);
+	clst = fat_create_chain (0);
+	if (clst == 0)
+		return false;
+	*sectorp = cluster_to_sector (clst);
+	return true;
+}
+
+/* The FAT picks clusters next-fit on its own, so NEAR is not used. */
+bool
+free_map_allocate_near (size_t cnt, disk_sector_t near UNUSED,
+		disk_sector_t *sectorp) {
+	return free_map_allocate (cnt, sectorp);
+}
+
+/* Makes CNT sectors starting at SECTOR available for use. */
+void
+free_map_release (disk_sector_t sector, size_t cnt) {
+	for (size_t i = 0; i < cnt; i++)
+		fat_remove_chain (sector_to_cluster (sector + i), 0);
+}
+#else
+/* Frees every extent. */
+static void
+clear_extents (void) {
+	while (!list_empty (&free_extents))
+		free (list_entry (list_pop_front (&free_extents),
+					struct free_extent, elem));
+}
+
+/* Rebuilds the extent list from FREE_MAP.  Leaves it stale if out of
+ * memory. */
+static void
+build_extents (void) {
+	size_t start = 0, end, bit_cnt = bitmap_size (free_map);
+
+	clear_extents ();
+	extents_stale = false;
+	free_cnt = bitmap_count (free_map, 0, bit_cnt, false);
+	while ((start = bitmap_scan (free_map, start, 1, false)) != BITMAP_ERROR) {
+		struct free_extent *x = malloc (sizeof *x);
+
+		end = bitmap_scan (free_map, start, 1, true);
+		if (end == BITMAP_ERROR)
+			end = bit_cnt;
+		if (x == NULL) {
+			extents_stale = true;
+			return;
+		}
+		x->start = start;
+		x->cnt = end - start;
+		list_push_back (&free_extents, &x->elem);
+		start = end;
+	}
+}
+
+/* Marks the free map file sectors that hold the bits for sectors
+ * SECTOR...SECTOR+CNT-1 as dirty. */
+static void
+mark_dirty (disk_sector_t sector, size_t cnt) {
+	size_t bits_per_sector = DISK_SECTOR_SIZE * 8;
+	size_t first = sector / bits_per_sector;
+	size_t last = (sector + cnt - 1) / bits_per_sector;
+
+	bitmap_set_multiple (dirty_sectors, first, last - first + 1, true);
+}
+
+/* Writes the dirty sectors of the free map file.  Before the file
+ * exists there is nothing to write; free_map_create() writes it all.
+ * Returns false if a write fails, leaving that sector dirty. */
+static bool
+write_dirty (void) {
+	size_t file_size = bitmap_file_size (free_map);
+	size_t idx = 0;
+	bool success = true;
+
+	if (free_map_file == NULL)
+		return true;
+	while ((idx = bitmap_scan (dirty_sectors, idx, 1, true))
+			!= BITMAP_ERROR) {
+		size_t ofs = idx * DISK_SECTOR_SIZE;
+		size_t size = file_size - ofs < DISK_SECTOR_SIZE
+			? file_size - ofs : DISK_SECTOR_SIZE;
+
+		if (bitmap_write_part (free_map, free_map_file, ofs, size))
+			bitmap_reset (dirty_sectors, idx);
+		else
+			success = false;
+		idx++;
+	}
+	return success;
+}
+
+/* Takes CNT sectors at SECTOR out of extent X, which must hold
+ * them.  Returns false if X would have to split and there is no
+ * memory for the second half. */
+static bool
+carve (struct free_extent *x, disk_sector_t sector, size_t cnt) {
+	disk_sector_t end = x->start + x->cnt;
+
+	ASSERT (sector >= x->start && sector + cnt <= end);
+
+	if (sector > x->start && sector + cnt < end) {
+		struct free_extent *tail = malloc (sizeof *tail);
+
+		if (tail == NULL)
+			return false;
+		tail->start = sector + cnt;
+		tail->cnt = end - tail->start;
+		list_insert (list_next (&x->elem), &tail->elem);
+		x->cnt = sector - x->start;
+	} else if (sector == x->start) {
+		x->start += cnt;
+		x->cnt -= cnt;
+	} else
+		x->cnt -= cnt;
+
+	if (x->cnt == 0) {
+		list_remove (&x->elem);
+		free (x);
+	}
+	return true;
+}
+
+/* Finds CNT free sectors in the extent list, as close after NEAR as
+ * it can, takes them out of the list and returns the first, or
+ * BITMAP_ERROR if no extent is long enough.  The search starts at the
+ * extent that holds or follows NEAR and wraps around to the start of
+ * the disk. */
+static disk_sector_t
+take_extent (size_t cnt, disk_sector_t near) {
+	struct list_elem *e, *from;
+
+	for (from = list_begin (&free_extents); from != list_end (&free_extents);
+			from = list_next (from)) {
+		struct free_extent *x = list_entry (from, struct free_extent, elem);
+
+		if (x->start + x->cnt > near)
+			break;
+	}
+
+	if (list_empty (&free_extents))
+		return BITMAP_ERROR;
+	if (from == list_end (&free_extents))
+		from = list_begin (&free_extents);
+
+	e = from;
+	do {
+		struct free_extent *x = list_entry (e, struct free_extent, elem);
+
+		if (x->cnt >= cnt) {
+			disk_sector_t sector = x->start;
+
+			/* Right at NEAR if it fits, otherwise at the start. */
+			if (near > x->start && near + cnt <= x->start + x->cnt
+					&& carve (x, near, cnt))
+				return near;
+			carve (x, sector, cnt);
+			return sector;
+		}
+		e = list_next (e);
+		if (e == list_end (&free_extents))
+			e = list_begin (&free_extents);
+	} while (e != from);
+	return BITMAP_ERROR;
+}
+
+/* Adds CNT sectors at SECTOR back to the extent list, merging them
+ * with their neighbors. */
+static void
+put_extent (disk_sector_t sector, size_t cnt) {
+	struct free_extent *prev = NULL, *next = NULL, *x;
+	struct list_elem *e;
+
+	for (e = list_begin (&free_extents); e != list_end (&free_extents);
+			e = list_next (e)) {
+		x = list_entry (e, struct free_extent, elem);
+		if (x->start > sector) {
+			next = x;
+			break;
+		}
+		prev = x;
+	}
+
+	if (prev != NULL && prev->start + prev->cnt == sector) {
+		prev->cnt += cnt;
+		if (next != NULL && sector + cnt == next->start) {
+			prev->cnt += next->cnt;
+			list_remove (&next->elem);
+			free (next);
+		}
+	} else if (next != NULL && sector + cnt == next->start) {
+		next->start = sector;
+		next->cnt += cnt;
+	} else if ((x = malloc (sizeof *x)) != NULL) {
+		x->start = sector;
+		x->cnt = cnt;
+		list_insert (e, &x->elem);
+	} else
+		extents_stale = true;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -24,25 +279,112 @@ free_map_init (void) {
  * available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
-	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
-		sector = BITMAP_ERROR;
+	return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Allocates CNT sectors near NEAR, like free_map_allocate_near().
+ * If RESERVED, the sectors come out of those set aside by
+ * free_map_reserve(); otherwise they must not eat into them. */
+static bool
+allocate (size_t cnt, disk_sector_t near, bool reserved,
+		disk_sector_t *sectorp) {
+	disk_sector_t sector = BITMAP_ERROR;
+
+	ASSERT (cnt > 0);
+
+	lock_acquire (&free_map_lock);
+	ASSERT (!reserved || reserved_cnt >= cnt);
+	if (!reserved && free_cnt - reserved_cnt < cnt)
+		goto done;
+	sector = take_extent (cnt, near);
+	if (sector == BITMAP_ERROR && extents_stale) {
+		build_extents ();
+		sector = take_extent (cnt, near);
+	}
+	if (sector == BITMAP_ERROR && extents_stale) {
+		/* Still out of memory for the list: fall back to the bitmap.
+		 * The list may hold the sectors found, so drop it. */
+		clear_extents ();
+		sector = bitmap_scan (free_map, 0, cnt, false);
 	}
+	if (sector != BITMAP_ERROR) {
+		ASSERT (bitmap_none (free_map, sector, cnt));
+		bitmap_set_multiple (free_map, sector, cnt, true);
+		mark_dirty (sector, cnt);
+		if (!write_dirty ()) {
+			bitmap_set_multiple (free_map, sector, cnt, false);
+			put_extent (sector, cnt);
+			sector = BITMAP_ERROR;
+		}
+	}
+	if (sector != BITMAP_ERROR) {
+		free_cnt -= cnt;
+		if (reserved)
+			reserved_cnt -= cnt;
+	}
+done:
+	lock_release (&free_map_lock);
+
 	if (sector != BITMAP_ERROR)
 		*sectorp = sector;
 	return sector != BITMAP_ERROR;
 }
 
+/* Like free_map_allocate(), but picks the free run closest after
+ * sector NEAR, so that blocks allocated one after another for the
+ * same file end up next to each other on disk. */
+bool
+free_map_allocate_near (size_t cnt, disk_sector_t near,
+		disk_sector_t *sectorp) {
+	return allocate (cnt, near, false, sectorp);
+}
+
+/* Sets aside CNT free sectors for later free_map_allocate_reserved()
+ * calls, so that data accepted now can be given blocks later without
+ * running out of space.  Returns false if there are not that many
+ * free sectors left. */
+bool
+free_map_reserve (size_t cnt) {
+	bool success;
+
+	lock_acquire (&free_map_lock);
+	success = free_cnt - reserved_cnt >= cnt;
+	if (success)
+		reserved_cnt += cnt;
+	lock_release (&free_map_lock);
+	return success;
+}
+
+/* Gives back CNT reserved sectors that were not needed. */
+void
+free_map_unreserve (size_t cnt) {
+	lock_acquire (&free_map_lock);
+	ASSERT (reserved_cnt >= cnt);
+	reserved_cnt -= cnt;
+	lock_release (&free_map_lock);
+}
+
+/* Allocates one of the sectors set aside by free_map_reserve(),
+ * near NEAR, and stores it into *SECTORP.  Can only fail if writing
+ * the free map fails. */
+bool
+free_map_allocate_reserved (disk_sector_t near, disk_sector_t *sectorp) {
+	return allocate (1, near, true, sectorp);
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
+	lock_acquire (&free_map_lock);
 	ASSERT (bitmap_all (free_map, sector, cnt));
 	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	put_extent (sector, cnt);
+	free_cnt += cnt;
+	mark_dirty (sector, cnt);
+	write_dirty ();
+	lock_release (&free_map_lock);
 }
+#endif
 
 /* Opens the free map file and reads it from disk. */
 void
@@ -50,8 +392,14 @@ free_map_open (void) {
 	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
 	if (free_map_file == NULL)
 		PANIC ("can't open free map");
+	inode_set_journaled (file_get_inode (free_map_file));
 	if (!bitmap_read (free_map, free_map_file))
 		PANIC ("can't read free map");
+#ifndef EFILESYS
+	lock_acquire (&free_map_lock);
+	build_extents ();
+	lock_release (&free_map_lock);
+#endif
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -68,10 +416,20 @@ free_map_create (void) {
 	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
 		PANIC ("free map creation failed");
 
-	/* Write bitmap to file. */
-	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-	if (free_map_file == NULL)
+	/* Write bitmap to file.  The first write allocates the file's
+	 * blocks, which changes the bitmap, so it is written again once
+	 * they are all in place; free_map_allocate() must not write the
+	 * file while the file itself is still growing. */
+	struct file *file = file_open (inode_open (FREE_MAP_SECTOR));
+	if (file == NULL)
 		PANIC ("can't open free map");
+	inode_set_journaled (file_get_inode (file));
+	if (!bitmap_write (free_map, file))
+		PANIC ("can't write free map");
+	free_map_file = file;
 	if (!bitmap_write (free_map, free_map_file))
 		PANIC ("can't write free map");
+#ifndef EFILESYS
+	bitmap_set_all (dirty_sectors, false);
+#endif
 }
@@ -1,73 +1,636 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/buffer-cache.h"
+#include "filesys/fat.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Blocks a removed inode gives back per journal handle, so that
+ * freeing a big file does not make one handle too big to log. */
+#define RELEASE_BATCH 8
+
+#ifdef EFILESYS
+/* Clusters at the start of a file that may be holes, one bit each in
+ * the on-disk inode. */
+#define HOLE_MAP_WORDS 125
+#define HOLE_MAP_CLUSTERS (HOLE_MAP_WORDS * 32)
+
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ * The data lives in the FAT chain that starts at START, which is 0
+ * until something is written.  The chain holds only the clusters that
+ * were written: bit I of PRESENT tells whether the file's Ith cluster
+ * is in it or is a hole, for the first HOLE_MAP_CLUSTERS clusters.
+ * Past those, the chain has no holes.  Holes, and bytes past the end
+ * of the chain but within LENGTH, read as zeros. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
+	cluster_t start;                    /* First data cluster, or 0. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t present[HOLE_MAP_WORDS];   /* Clusters that are not holes. */
 };
+#else
+/* Block pointers held directly in an inode, and in one indirect
+ * block. */
+#define DIRECT_CNT 123
+#define PTRS_PER_SECTOR ((size_t) (DISK_SECTOR_SIZE / sizeof (disk_sector_t)))
 
-/* Returns the number of sectors to allocate for an inode SIZE
- * bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size) {
-	return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
-}
+/* Largest file, in sectors: the direct blocks, then those reached
+ * through the indirect block, then through the doubly indirect one. */
+#define MAX_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+		+ PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
+/* Most appended sectors an inode holds in memory before giving them
+ * blocks, and the index blocks those may need on top: an indirect
+ * block, or a doubly indirect block and two blocks under it. */
+#define DELAY_SECTORS 8
+#define DELAY_INDEX_CNT 3
+
+/* On-disk inode.
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ * A block pointer of 0 is a hole: sector 0 holds the free map inode,
+ * so it is never a data or index block.  Holes read as zeros and get
+ * a block on first write; a new file is all holes, so creating one
+ * costs no I/O beyond its inode. */
+struct inode_disk {
+	off_t length;                       /* File size in bytes. */
+	unsigned magic;                     /* Magic number. */
+	disk_sector_t direct[DIRECT_CNT];   /* Data blocks. */
+	disk_sector_t indirect;             /* Block of data block pointers. */
+	disk_sector_t double_indirect;      /* Block of indirect blocks. */
+	uint32_t unused[1];                 /* Not used. */
+};
+#endif
 
-/* In-memory inode. */
+/* In-memory inode.  LOCK serializes reads and writes of the data:
+ * the page fault and eviction paths read and write mapped files
+ * without the file system lock, so nothing else keeps them apart. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in OPEN_INODES. */
 	disk_sector_t sector;               /* Sector number of disk location. */
+	struct lock lock;                   /* Protects the fields below. */
 	int open_cnt;                       /* Number of openers. */
+	bool closing;                       /* Last opener is tearing down. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	unsigned write_gen;                 /* Bumped on every write. */
+	bool data_changed;                  /* DATA differs from its sector. */
+	bool journaled;                     /* Data is metadata. */
+	void *private;                      /* See inode_set_private(). */
+	void (*private_destroy) (void *);   /* Frees PRIVATE. */
+#ifdef EFILESYS
+	/* Cluster-offset cache: CLUSTERS[I] is the file's Ith cluster, or
+	 * 0 for a hole, for the first CLUSTER_CNT clusters of the file.
+	 * Filled in as the chain is walked, so each link is followed once
+	 * per open and a seek anywhere in that prefix costs no walk at
+	 * all.  LAST is the last chain cluster in there, 0 if none. */
+	cluster_t *clusters;
+	size_t cluster_cnt;
+	size_t cluster_cap;                 /* Allocated slots in CLUSTERS. */
+	cluster_t last;
+#else
+	disk_sector_t next_alloc;           /* Where to put the next block. */
+
+	/* Delayed allocation: appended data not yet given blocks.  DELAYED
+	 * holds DELAY_CNT sectors' worth of the file starting at byte
+	 * DELAY_OFS, all holes in DATA.  RESERVED sectors are set aside in
+	 * the free map so that giving them blocks later cannot fail for
+	 * lack of space. */
+	uint8_t *delayed;
+	off_t delay_ofs;
+	size_t delay_cnt;
+	size_t reserved;
+#endif
 	struct inode_disk data;             /* Inode content. */
 };
 
+#ifdef EFILESYS
+/* Appends CLST to INODE's cluster-offset cache.  Returns false if
+ * memory runs out. */
+static bool
+chain_push (struct inode *inode, cluster_t clst) {
+	if (inode->cluster_cnt == inode->cluster_cap) {
+		size_t cap = inode->cluster_cap > 0 ? inode->cluster_cap * 2 : 16;
+		cluster_t *clusters = realloc (inode->clusters,
+				cap * sizeof *clusters);
+		if (clusters == NULL)
+			return false;
+		inode->clusters = clusters;
+		inode->cluster_cap = cap;
+	}
+	inode->clusters[inode->cluster_cnt++] = clst;
+	return true;
+}
+
+/* Returns true if the file's IDXth cluster is a hole in DATA. */
+static bool
+is_hole (const struct inode_disk *data, size_t idx) {
+	return idx < HOLE_MAP_CLUSTERS
+		&& (data->present[idx / 32] & (1u << idx % 32)) == 0;
+}
+
+/* Gives INODE a zeroed cluster and links it into the chain right
+ * after PREV, or at the start if PREV is 0, ahead of the rest of the
+ * chain.  Returns the cluster, or 0 if the disk is full. */
+static cluster_t
+chain_insert (struct inode *inode, cluster_t prev) {
+	cluster_t next = prev != 0 ? fat_get (prev) : inode->data.start;
+	cluster_t clst = fat_create_chain (prev);
+
+	if (clst == 0)
+		return 0;
+	if (next != 0 && next != EOChain)
+		fat_put (clst, next);
+	if (prev == 0) {
+		inode->data.start = clst;
+		inode->data_changed = true;
+	}
+	if (inode->journaled)
+		journal_zero (cluster_to_sector (clst));
+	else
+		buffer_cache_zero (cluster_to_sector (clst));
+	return clst;
+}
+
+/* Ends the journal handle that byte_to_sector() runs in and opens
+ * another, recording INODE's changed data first, so that filling a
+ * long gap past the hole map does not make one handle too big to log.
+ * The gap lies past the end of the file, so a crash in between only
+ * leaves some of it allocated. */
+static void
+split_handle (struct inode *inode) {
+	if (inode->data_changed) {
+		journal_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+		inode->data_changed = false;
+	}
+	journal_end ();
+	journal_begin ();
+}
+
+/* Returns the disk sector that contains byte offset POS within
+ * INODE, or 0 if that part of INODE is a hole or past the end of the
+ * chain.  If CREATE is true, a hole gets a zeroed cluster, and past
+ * the hole map the chain is extended with zeroed clusters as needed,
+ * one journal handle per cluster, so 0 then means the disk is
+ * full. */
+static disk_sector_t
+byte_to_sector (struct inode *inode, off_t pos, bool create) {
+	size_t idx = pos / (DISK_SECTOR_SIZE * SECTORS_PER_CLUSTER);
+	cluster_t clst;
+
+	ASSERT (inode != NULL);
+	ASSERT (pos >= 0);
+
+	while (inode->cluster_cnt <= idx) {
+		cluster_t next = 0;
+		bool added = false;
+
+		if (!is_hole (&inode->data, inode->cluster_cnt)) {
+			next = inode->last != 0 ? fat_get (inode->last)
+				: inode->data.start;
+			if (next == 0 || next == EOChain) {
+				if (!create || inode->cluster_cnt < HOLE_MAP_CLUSTERS)
+					break;
+				next = chain_insert (inode, inode->last);
+				if (next == 0)
+					return 0;
+				added = true;
+			}
+		}
+		if (!chain_push (inode, next))
+			return 0;
+		if (next != 0)
+			inode->last = next;
+		if (added && inode->cluster_cnt <= idx)
+			split_handle (inode);
+	}
+
+	clst = idx < inode->cluster_cnt ? inode->clusters[idx] : 0;
+	if (clst == 0 && create && idx < HOLE_MAP_CLUSTERS) {
+		/* Fill the hole, linking the new cluster in after the
+		 * nearest cluster before it. */
+		cluster_t prev = 0;
+
+		for (size_t i = idx < inode->cluster_cnt ? idx : inode->cluster_cnt;
+				i > 0 && prev == 0; i--)
+			prev = inode->clusters[i - 1];
+		clst = chain_insert (inode, prev);
+		if (clst == 0)
+			return 0;
+		inode->data.present[idx / 32] |= 1u << idx % 32;
+		inode->data_changed = true;
+		if (idx < inode->cluster_cnt) {
+			inode->clusters[idx] = clst;
+			if (prev == inode->last)
+				inode->last = clst;
+		}
+	}
+	if (clst == 0)
+		return 0;
+	return cluster_to_sector (clst)
+		+ pos / DISK_SECTOR_SIZE % SECTORS_PER_CLUSTER;
+}
+
+/* Releases every cluster of the inode DATA, RELEASE_BATCH to a
+ * journal handle.  Must not be called inside a handle. */
+static void
+release_blocks (const struct inode_disk *data) {
+	cluster_t clst = data->start;
+
+	while (clst != 0 && clst != EOChain) {
+		journal_begin ();
+		for (int i = 0; i < RELEASE_BATCH && clst != 0 && clst != EOChain;
+				i++) {
+			cluster_t next = fat_get (clst);
+
+			fat_put (clst, 0);
+			clst = next;
+		}
+		journal_end ();
+	}
+}
+
+#else
+
+/* Allocates a sector for INODE, zeroes it in the buffer cache and
+ * stores it in *SECTORP.  The zeros reach the disk only when the cache
+ * writes the sector back, by which time it usually holds real data.
+ * INDEX is true for an index block; that, and any block of an inode
+ * that holds metadata, is zeroed through the journal.  Returns false
+ * if the disk is full. */
+static bool
+alloc_zeroed (struct inode *inode, disk_sector_t *sectorp, bool index) {
+	if (inode->reserved > 0) {
+		if (!free_map_allocate_reserved (inode->next_alloc, sectorp))
+			return false;
+		inode->reserved--;
+	} else if (!free_map_allocate_near (1, inode->next_alloc, sectorp))
+		return false;
+	inode->next_alloc = *sectorp + 1;
+	if (index || inode->journaled)
+		journal_zero (*sectorp);
+	else
+		buffer_cache_zero (*sectorp);
+	return true;
+}
+
+/* Returns the block that pointer *SLOT in INODE's in-memory inode
+ * names.  If it is a hole and CREATE is true, a block is allocated
+ * for it first, an index block if INDEX.  Returns 0 for a hole. */
+static disk_sector_t
+slot_get (struct inode *inode, disk_sector_t *slot, bool create,
+		bool index) {
+	if (*slot == 0 && create && alloc_zeroed (inode, slot, index))
+		inode->data_changed = true;
+	return *slot;
+}
+
+/* Like slot_get(), for pointer IDX of index block BLOCK. */
+static disk_sector_t
+index_get (struct inode *inode, disk_sector_t block, size_t idx,
+		bool create, bool index) {
+	disk_sector_t sector;
+
+	buffer_cache_read (block, &sector, idx * sizeof sector, sizeof sector);
+	if (sector == 0 && create && alloc_zeroed (inode, &sector, index))
+		journal_write (block, &sector, idx * sizeof sector, sizeof sector);
+	return sector;
+}
+
 /* Returns the disk sector that contains byte offset POS within
- * INODE.
- * Returns -1 if INODE does not contain data for a byte at offset
- * POS. */
+ * INODE, or 0 if that part of INODE is a hole.  If CREATE is true,
+ * blocks are allocated as needed to fill the hole, so 0 then means
+ * the disk is full or POS is past the largest file size. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) {
+byte_to_sector (struct inode *inode, off_t pos, bool create) {
+	struct inode_disk *data = &inode->data;
+	size_t idx = pos / DISK_SECTOR_SIZE;
+	disk_sector_t block;
+
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
+	ASSERT (pos >= 0);
+
+	if (idx < DIRECT_CNT)
+		return slot_get (inode, &data->direct[idx], create, false);
+	idx -= DIRECT_CNT;
+
+	if (idx < PTRS_PER_SECTOR) {
+		block = slot_get (inode, &data->indirect, create, true);
+		return block != 0 ? index_get (inode, block, idx, create, false) : 0;
+	}
+	idx -= PTRS_PER_SECTOR;
+
+	if (idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR) {
+		block = slot_get (inode, &data->double_indirect, create, true);
+		if (block != 0)
+			block = index_get (inode, block, idx / PTRS_PER_SECTOR, create,
+					true);
+		return block != 0
+			? index_get (inode, block, idx % PTRS_PER_SECTOR, create, false)
+			: 0;
+	}
+	return 0;
+}
+
+/* Blocks waiting to be released together, in one journal handle. */
+struct release_batch {
+	disk_sector_t blocks[RELEASE_BATCH];
+	size_t cnt;
+};
+
+/* Releases the blocks in B. */
+static void
+release_flush (struct release_batch *b) {
+	journal_begin ();
+	for (size_t i = 0; i < b->cnt; i++)
+		free_map_release (b->blocks[i], 1);
+	journal_end ();
+	b->cnt = 0;
+}
+
+/* Adds BLOCK to B, releasing the batch once it is full. */
+static void
+release_add (struct release_batch *b, disk_sector_t block) {
+	b->blocks[b->cnt++] = block;
+	if (b->cnt == RELEASE_BATCH)
+		release_flush (b);
+}
+
+/* Releases BLOCK and, if LEVEL is above 0, the blocks it points to,
+ * which are index blocks themselves for LEVEL 2.  An index block is
+ * read before, and released after, the blocks it points to, so it
+ * cannot be handed out again while it is still needed. */
+static void
+release_tree (struct release_batch *b, disk_sector_t block, int level) {
+	if (level > 0) {
+		disk_sector_t ptrs[PTRS_PER_SECTOR];
+
+		buffer_cache_read (block, ptrs, 0, DISK_SECTOR_SIZE);
+		for (size_t i = 0; i < PTRS_PER_SECTOR; i++)
+			if (ptrs[i] != 0)
+				release_tree (b, ptrs[i], level - 1);
+	}
+	release_add (b, block);
+}
+
+/* Releases every block of the inode DATA, RELEASE_BATCH to a journal
+ * handle.  Must not be called inside a handle. */
+static void
+release_blocks (const struct inode_disk *data) {
+	struct release_batch b;
+
+	b.cnt = 0;
+	for (size_t i = 0; i < DIRECT_CNT; i++)
+		if (data->direct[i] != 0)
+			release_add (&b, data->direct[i]);
+	if (data->indirect != 0)
+		release_tree (&b, data->indirect, 1);
+	if (data->double_indirect != 0)
+		release_tree (&b, data->double_indirect, 2);
+	if (b.cnt > 0)
+		release_flush (&b);
+}
+#endif
+
+
+/* Writes SIZE bytes from BUFFER to byte SECTOR_OFS of SECTOR, one of
+ * INODE's data sectors: through the journal if INODE holds metadata,
+ * see inode_set_journaled(). */
+static void
+data_write (struct inode *inode, disk_sector_t sector, const void *buffer,
+		int sector_ofs, int size) {
+	if (inode->journaled)
+		journal_write (sector, buffer, sector_ofs, size);
 	else
-		return -1;
+		buffer_cache_write (sector, buffer, sector_ofs, size);
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns the sector that holds byte POS of INODE, giving it a block
+ * if it has none.  The allocation and the inode update that records
+ * it are one journal handle.  Returns 0 if the disk is full. */
+static disk_sector_t
+allocate_sector (struct inode *inode, off_t pos) {
+	disk_sector_t sector;
+
+	journal_begin ();
+	sector = byte_to_sector (inode, pos, true);
+	if (inode->data_changed) {
+		journal_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+		inode->data_changed = false;
+	}
+	journal_end ();
+	return sector;
+}
+
+#ifdef EFILESYS
+/* The FAT layout gives appended data clusters right away. */
+static bool
+delay_write (struct inode *inode UNUSED, off_t offset UNUSED,
+		const void *buffer UNUSED, int size UNUSED) {
+	return false;
+}
+
+static bool
+delay_read (struct inode *inode UNUSED, off_t offset UNUSED,
+		void *buffer UNUSED, int size UNUSED) {
+	return false;
+}
+
+static void
+delay_flush (struct inode *inode UNUSED) {
+}
+
+static void
+delay_drop (struct inode *inode UNUSED) {
+}
+#else
+/* Frees INODE's delayed data without writing it, and gives back its
+ * reserved sectors. */
+static void
+delay_drop (struct inode *inode) {
+	free (inode->delayed);
+	inode->delayed = NULL;
+	inode->delay_cnt = 0;
+	if (inode->reserved > 0) {
+		free_map_unreserve (inode->reserved);
+		inode->reserved = 0;
+	}
+}
+
+/* Gives INODE's delayed sectors blocks, in file order so that they
+ * come out next to each other on disk, and writes them to the
+ * buffer cache whole, without reading anything. */
+static void
+delay_flush (struct inode *inode) {
+	if (inode->delayed == NULL)
+		return;
+
+	for (size_t i = 0; i < inode->delay_cnt; i++) {
+		off_t ofs = inode->delay_ofs + (off_t) i * DISK_SECTOR_SIZE;
+		disk_sector_t sector = allocate_sector (inode, ofs);
+
+		if (sector != 0)
+			buffer_cache_write (sector, inode->delayed
+					+ i * DISK_SECTOR_SIZE, 0, DISK_SECTOR_SIZE);
+	}
+	delay_drop (inode);
+}
+
+/* Writes SIZE bytes from BUFFER at OFFSET of INODE into its delayed
+ * data, if that is where they belong: the bytes, which lie within
+ * one sector, must fall in the delayed sectors or be an append into a
+ * hole right after them or at the end of the file.  Returns false,
+ * having done nothing, if the bytes need a block now. */
+static bool
+delay_write (struct inode *inode, off_t offset, const void *buffer,
+		int size) {
+	off_t start = offset - offset % DISK_SECTOR_SIZE;
+
+	/* Metadata gets its blocks within the journal handle that
+	 * writes it.  That covers the free map file, which is written with
+	 * the free map locked and so must not wait for an allocation. */
+	if (inode->journaled)
+		return false;
+
+	if (inode->delayed != NULL) {
+		off_t end = inode->delay_ofs
+			+ (off_t) inode->delay_cnt * DISK_SECTOR_SIZE;
+
+		if (start < inode->delay_ofs) {
+			/* A hole before the delayed sectors needs a block now.
+			 * The delayed ones get theirs first, so that they stay
+			 * the only users of the reservation. */
+			if (byte_to_sector (inode, start, false) == 0)
+				delay_flush (inode);
+			return false;
+		}
+		if (start == end && inode->delay_cnt < DELAY_SECTORS
+				&& byte_to_sector (inode, start, false) == 0
+				&& free_map_reserve (1)) {
+			inode->reserved++;
+			memset (inode->delayed + (end - inode->delay_ofs), 0,
+					DISK_SECTOR_SIZE);
+			inode->delay_cnt++;
+		}
+		if (start >= inode->delay_ofs + (off_t) inode->delay_cnt
+				* DISK_SECTOR_SIZE) {
+			/* Not contiguous, or full: blocks go in file order, so
+			 * these get theirs first. */
+			delay_flush (inode);
+		} else {
+			memcpy (inode->delayed + (offset - inode->delay_ofs), buffer,
+					size);
+			return true;
+		}
+	}
+
+	/* Start delaying only appends, into a hole. */
+	if (start + DISK_SECTOR_SIZE <= inode_length (inode)
+			|| byte_to_sector (inode, start, false) != 0
+			|| !free_map_reserve (1 + DELAY_INDEX_CNT))
+		return false;
+	inode->delayed = malloc (DELAY_SECTORS * DISK_SECTOR_SIZE);
+	if (inode->delayed == NULL) {
+		free_map_unreserve (1 + DELAY_INDEX_CNT);
+		return false;
+	}
+	inode->reserved = 1 + DELAY_INDEX_CNT;
+	inode->delay_ofs = start;
+	inode->delay_cnt = 1;
+	memset (inode->delayed, 0, DISK_SECTOR_SIZE);
+	memcpy (inode->delayed + (offset - start), buffer, size);
+	return true;
+}
+
+/* Copies SIZE bytes at OFFSET of INODE, which lie within one
+ * sector, into BUFFER if they are in its delayed data.  Returns false
+ * otherwise. */
+static bool
+delay_read (struct inode *inode, off_t offset, void *buffer, int size) {
+	if (inode->delayed == NULL || offset < inode->delay_ofs
+			|| offset >= inode->delay_ofs
+			+ (off_t) inode->delay_cnt * DISK_SECTOR_SIZE)
+		return false;
+	memcpy (buffer, inode->delayed + (offset - inode->delay_ofs), size);
+	return true;
+}
+#endif
+
+/* Open inodes, hashed on sector, so that opening a single inode
+ * twice returns the same `struct inode'.  OPEN_INODES_LOCK protects
+ * the table and every inode's OPEN_CNT and CLOSING.  An inode stays
+ * in the table, marked closing, while its last closer flushes or
+ * releases its blocks; openers of that sector wait on INODE_GONE
+ * until it has left the table, then read the inode afresh. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+static struct condition inode_gone;
+
+/* Returns a hash value for the inode that E is embedded in. */
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Orders inodes by sector. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct inode, elem)->sector
+		< hash_entry (b, struct inode, elem)->sector;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+		PANIC ("inode: out of memory");
+	lock_init (&open_inodes_lock);
+	cond_init (&inode_gone);
+}
+
+/* Returns the open inode for SECTOR with its open count raised, or
+ * a null pointer if SECTOR is not open.  If the inode for SECTOR is
+ * being closed, waits until it is gone.  OPEN_INODES_LOCK must be
+ * held. */
+static struct inode *
+find_open (disk_sector_t sector) {
+	struct inode key, *inode;
+	struct hash_elem *e;
+
+	key.sector = sector;
+	for (;;) {
+		e = hash_find (&open_inodes, &key.elem);
+		if (e == NULL)
+			return NULL;
+		inode = hash_entry (e, struct inode, elem);
+		if (!inode->closing)
+			break;
+		cond_wait (&inode_gone, &open_inodes_lock);
+	}
+	inode->open_cnt++;
+	return inode;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
  * writes the new inode to sector SECTOR on the file system
- * disk.
+ * disk.  The data starts out as one hole, so no blocks are
+ * allocated or zeroed until they are written.
  * Returns true if successful.
- * Returns false if memory or disk allocation fails. */
+ * Returns false if memory allocation fails or LENGTH is larger than
+ * the largest file. */
 bool
 inode_create (disk_sector_t sector, off_t length) {
 	struct inode_disk *disk_inode = NULL;
-	bool success = false;
 
 	ASSERT (length >= 0);
 
@@ -75,25 +638,18 @@ inode_create (disk_sector_t sector, off_t length) {
 	 * one sector in size, and you should fix that. */
 	ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
 
+#ifndef EFILESYS
+	if ((size_t) DIV_ROUND_UP (length, DISK_SECTOR_SIZE) > MAX_SECTORS)
+		return false;
+#endif
 	disk_inode = calloc (1, sizeof *disk_inode);
-	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
-		disk_inode->length = length;
-		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
-			success = true; 
-		} 
-		free (disk_inode);
-	}
-	return success;
+	if (disk_inode == NULL)
+		return false;
+	disk_inode->length = length;
+	disk_inode->magic = INODE_MAGIC;
+	journal_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
+	free (disk_inode);
+	return true;
 }
 
 /* Reads an inode from SECTOR
@@ -101,18 +657,15 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
-	struct inode *inode;
-
-	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
-		}
-	}
+	struct inode *inode, *other;
+
+	/* Check whether this inode is already open.  If so, its contents
+	 * are in memory already and nothing needs to be read. */
+	lock_acquire (&open_inodes_lock);
+	inode = find_open (sector);
+	lock_release (&open_inodes_lock);
+	if (inode != NULL)
+		return inode;
 
 	/* Allocate memory. */
 	inode = malloc (sizeof *inode);
@@ -120,20 +673,51 @@ inode_open (disk_sector_t sector) {
 		return NULL;
 
 	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
 	inode->sector = sector;
+	lock_init (&inode->lock);
 	inode->open_cnt = 1;
+	inode->closing = false;
 	inode->deny_write_cnt = 0;
+	inode->write_gen = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->data_changed = false;
+	inode->private = NULL;
+	inode->private_destroy = NULL;
+	inode->journaled = false;
+#ifdef EFILESYS
+	inode->clusters = NULL;
+	inode->cluster_cnt = inode->cluster_cap = 0;
+	inode->last = 0;
+#else
+	inode->next_alloc = sector + 1;
+	inode->delayed = NULL;
+	inode->delay_cnt = 0;
+	inode->reserved = 0;
+#endif
+	buffer_cache_read (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+
+	/* The read may have slept, so someone else may have opened
+	 * SECTOR meanwhile.  If so, use theirs. */
+	lock_acquire (&open_inodes_lock);
+	other = find_open (sector);
+	if (other == NULL)
+		hash_insert (&open_inodes, &inode->elem);
+	lock_release (&open_inodes_lock);
+	if (other != NULL) {
+		free (inode);
+		return other;
+	}
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		lock_acquire (&open_inodes_lock);
 		inode->open_cnt++;
+		lock_release (&open_inodes_lock);
+	}
 	return inode;
 }
 
@@ -148,26 +732,85 @@ inode_get_inumber (const struct inode *inode) {
  * If INODE was also a removed inode, frees its blocks. */
 void
 inode_close (struct inode *inode) {
+	bool last;
+
 	/* Ignore null pointer. */
 	if (inode == NULL)
 		return;
 
-	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+	/* Release resources if this was the last opener.  The inode
+	 * stays in the table, marked closing, until its blocks are
+	 * flushed or released, so that nobody reads a stale copy of it
+	 * from disk meanwhile. */
+	lock_acquire (&open_inodes_lock);
+	last = --inode->open_cnt == 0;
+	if (last)
+		inode->closing = true;
+	lock_release (&open_inodes_lock);
 
-		/* Deallocate blocks if removed. */
+	if (last) {
+		/* Deallocate blocks if removed, otherwise give delayed data
+		 * its blocks.  A big file takes several journal handles to
+		 * free; a crash in between leaks the rest of its blocks but
+		 * leaves the file system consistent. */
 		if (inode->removed) {
+			delay_drop (inode);
+			release_blocks (&inode->data);
+			journal_begin ();
 			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
-		}
+			journal_end ();
+		} else
+			delay_flush (inode);
+#ifdef EFILESYS
+		free (inode->clusters);
+#endif
+		if (inode->private_destroy != NULL)
+			inode->private_destroy (inode->private);
+
+		lock_acquire (&open_inodes_lock);
+		hash_delete (&open_inodes, &inode->elem);
+		cond_broadcast (&inode_gone, &open_inodes_lock);
+		lock_release (&open_inodes_lock);
 
 		free (inode); 
 	}
 }
 
+/* Gives the delayed data of every open inode its blocks and writes it
+ * to the buffer cache, so that it is not lost at shutdown and does
+ * not stay in memory for long while the file is held open.  Each
+ * inode is kept open meanwhile, so the table lock is not held during
+ * the I/O. */
+void
+inode_flush_delayed (void) {
+	struct hash_iterator i;
+	struct inode **inodes;
+	size_t cnt = 0;
+
+	lock_acquire (&open_inodes_lock);
+	inodes = malloc (hash_size (&open_inodes) * sizeof *inodes);
+	if (inodes != NULL) {
+		hash_first (&i, &open_inodes);
+		while (hash_next (&i)) {
+			struct inode *inode = hash_entry (hash_cur (&i), struct inode,
+					elem);
+			if (!inode->closing) {
+				inode->open_cnt++;
+				inodes[cnt++] = inode;
+			}
+		}
+	}
+	lock_release (&open_inodes_lock);
+
+	for (size_t j = 0; j < cnt; j++) {
+		lock_acquire (&inodes[j]->lock);
+		delay_flush (inodes[j]);
+		lock_release (&inodes[j]->lock);
+		inode_close (inodes[j]);
+	}
+	free (inodes);
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
  * has it open. */
 void
@@ -178,43 +821,50 @@ inode_remove (struct inode *inode) {
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
  * Returns the number of bytes actually read, which may be less
- * than SIZE if an error occurs or end of file is reached. */
+ * than SIZE if an error occurs or end of file is reached.
+ * BUFFER may be user memory, and a page fault on it may read or write
+ * this very inode, so it is never touched with INODE's lock held:
+ * each chunk goes through a bounce buffer. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
+	uint8_t *bounce;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
+
+	bounce = malloc (DISK_SECTOR_SIZE);
+	if (bounce == NULL)
+		return 0;
 
 	while (size > 0) {
-		/* Disk sector to read, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
+		off_t inode_left;
+		int sector_left, min_left, chunk_size;
+
+		lock_acquire (&inode->lock);
+
+		/* Disk sector to read. */
+		sector_idx = byte_to_sector (inode, offset, false);
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
-		off_t inode_left = inode_length (inode) - offset;
-		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-		int min_left = inode_left < sector_left ? inode_left : sector_left;
+		inode_left = inode_length (inode) - offset;
+		sector_left = DISK_SECTOR_SIZE - sector_ofs;
+		min_left = inode_left < sector_left ? inode_left : sector_left;
 
 		/* Number of bytes to actually copy out of this sector. */
-		int chunk_size = size < min_left ? size : min_left;
-		if (chunk_size <= 0)
+		chunk_size = size < min_left ? size : min_left;
+		if (chunk_size <= 0) {
+			lock_release (&inode->lock);
 			break;
-
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
 		}
 
+		if (sector_idx != 0)
+			buffer_cache_read (sector_idx, bounce, sector_ofs, chunk_size);
+		else if (!delay_read (inode, offset, bounce, chunk_size))
+			memset (bounce, 0, chunk_size);
+		lock_release (&inode->lock);
+		memcpy (buffer + bytes_read, bounce, chunk_size);
+
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
@@ -225,57 +875,79 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	return bytes_read;
 }
 
+/* Queues the sectors that hold bytes [OFFSET, OFFSET + SIZE) of INODE
+ * for the read-ahead daemon.  Bytes past the end of the file and
+ * holes are ignored. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size) {
+	off_t end = offset + size;
+
+	lock_acquire (&inode->lock);
+	if (end > inode_length (inode))
+		end = inode_length (inode);
+	for (offset -= offset % DISK_SECTOR_SIZE; offset < end;
+			offset += DISK_SECTOR_SIZE) {
+		disk_sector_t sector = byte_to_sector (inode, offset, false);
+		if (sector != 0)
+			buffer_cache_prefetch (sector);
+	}
+	lock_release (&inode->lock);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * A write past the end of file extends INODE; any gap between the
+ * old end and OFFSET is left as a hole.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if the disk fills up or the largest file size is
+ * reached.  Like inode_read_at(), copies BUFFER through a bounce
+ * buffer. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
+	uint8_t *bounce;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
 
-	if (inode->deny_write_cnt)
+	bounce = malloc (DISK_SECTOR_SIZE);
+	if (bounce == NULL)
+		return 0;
+
+	lock_acquire (&inode->lock);
+	if (inode->deny_write_cnt) {
+		lock_release (&inode->lock);
+		free (bounce);
 		return 0;
+	}
+	inode->write_gen++;
+	lock_release (&inode->lock);
 
 	while (size > 0) {
-		/* Sector to write, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		/* Starting byte offset within sector. */
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
-		/* Bytes left in inode, bytes left in sector, lesser of the two. */
-		off_t inode_left = inode_length (inode) - offset;
+		/* Bytes left in sector. */
 		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-		int min_left = inode_left < sector_left ? inode_left : sector_left;
 
 		/* Number of bytes to actually write into this sector. */
-		int chunk_size = size < min_left ? size : min_left;
-		if (chunk_size <= 0)
-			break;
+		int chunk_size = size < sector_left ? size : sector_left;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
+		/* Appends stay in memory for now; anything else goes to the
+		 * sector, which gets a block if it has none.  The cache
+		 * reads the sector in first unless the chunk covers all of
+		 * it. */
+		memcpy (bounce, buffer + bytes_written, chunk_size);
+		lock_acquire (&inode->lock);
+		if (!delay_write (inode, offset, bounce, chunk_size)) {
+			disk_sector_t sector_idx = byte_to_sector (inode, offset, false);
+			if (sector_idx == 0)
+				sector_idx = allocate_sector (inode, offset);
+			if (sector_idx == 0) {
+				lock_release (&inode->lock);
+				break;
 			}
-
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
+			data_write (inode, sector_idx, bounce, sector_ofs, chunk_size);
 		}
+		lock_release (&inode->lock);
 
 		/* Advance. */
 		size -= chunk_size;
@@ -284,6 +956,16 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	}
 	free (bounce);
 
+	lock_acquire (&inode->lock);
+	if (offset > inode->data.length) {
+		inode->data.length = offset;
+		inode->data_changed = true;
+	}
+	if (inode->data_changed) {
+		journal_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+		inode->data_changed = false;
+	}
+	lock_release (&inode->lock);
 	return bytes_written;
 }
 
@@ -311,3 +993,35 @@ off_t
 inode_length (const struct inode *inode) {
 	return inode->data.length;
 }
+
+/* Makes writes to INODE's data go through the journal, for an inode
+ * whose contents are file system metadata, e.g. a directory. */
+void
+inode_set_journaled (struct inode *inode) {
+	inode->journaled = true;
+}
+
+/* Returns the data set by inode_set_private(), or a null pointer. */
+void *
+inode_get_private (const struct inode *inode) {
+	return inode->private;
+}
+
+/* Attaches PRIVATE to INODE for as long as it stays open, so that a
+ * layer above, e.g. directories, can keep derived state that all
+ * openers share.  DESTROY, if non-null, is called on PRIVATE when the
+ * inode is closed for the last time. */
+void
+inode_set_private (struct inode *inode, void *private,
+		void (*destroy) (void *)) {
+	inode->private = private;
+	inode->private_destroy = destroy;
+}
+
+/* Returns INODE's write generation, which changes whenever
+ * INODE's data is written.  Lets callers that cache file
+ * contents detect stale copies. */
+unsigned
+inode_write_gen (const struct inode *inode) {
+	return inode->write_gen;
+}
@@ -0,0 +1,329 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/buffer-cache.h"
+#include "filesys/fat.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead journal for file system metadata.
+ *
+ * Metadata -- inode sectors, index blocks, directory and free map
+ * contents, and with EFILESYS the FAT -- is changed only inside a
+ * handle, journal_begin() ... journal_end(), which brackets one
+ * operation.  Journaled sectors stay pinned in the buffer cache until
+ * a commit, which waits for the open handles to end and then:
+ *
+ *   1. writes every pinned block to the journal region,
+ *   2. writes the header, naming the blocks' home sectors: this single
+ *      sector write is the commit point,
+ *   3. writes the blocks home (checkpoint), and
+ *   4. clears the header.
+ *
+ * Commits are batched: one covers every operation since the last, and
+ * happens when enough blocks are pending, every COMMIT_INTERVAL, or
+ * at shutdown.  After a crash, journal_init() copies the blocks of a
+ * committed header home again, which costs time in proportion to the
+ * journal, not the disk.  A crash before step 2 loses the operations
+ * of that batch, but never half of one.
+ *
+ * File data is not journaled, only metadata. */
+
+/* Identifies a header that names a committed transaction. */
+#define JOURNAL_MAGIC 0x4a4e4c31
+
+/* Most blocks one commit can log. */
+#define JOURNAL_BLOCKS (JOURNAL_SECTORS - 1)
+
+/* Pending blocks that make the last handle to end commit. */
+#define COMMIT_THRESHOLD 16
+
+/* Most handles open at once. */
+#define MAX_HANDLES 4
+
+/* Most blocks one handle may log.  The largest handle is a create
+ * that grows its directory: the new inode, two directory sectors, a
+ * new indirect and double indirect block, the directory's inode, and
+ * the free map sectors of those allocations.  Releasing a removed
+ * inode's blocks takes several handles, none of them bigger. */
+#define HANDLE_BLOCKS 11
+
+/* A handle is let in only while fewer than COMMIT_THRESHOLD blocks are
+ * pending, and until the next commit no more than the MAX_HANDLES
+ * handles open by then can add to them.  So a batch always fits both
+ * the journal and the part of the buffer cache that may hold journaled
+ * blocks, which the cache cannot evict. */
+#if COMMIT_THRESHOLD + MAX_HANDLES * HANDLE_BLOCKS > JOURNAL_BLOCKS
+#error A batch of handles may not fit in the journal.
+#endif
+#if COMMIT_THRESHOLD + MAX_HANDLES * HANDLE_BLOCKS > BUFFER_CACHE_JOURNALED_MAX
+#error A batch of handles may not fit in the buffer cache.
+#endif
+
+/* Ticks between two commits by the commit daemon. */
+#define COMMIT_INTERVAL (5 * TIMER_FREQ)
+
+/* Journal header, the first sector of the journal region. */
+struct journal_header {
+	unsigned magic;                     /* JOURNAL_MAGIC. */
+	uint32_t seq;                       /* Transaction number. */
+	uint32_t cnt;                       /* Blocks logged, 0 if none. */
+	disk_sector_t home[JOURNAL_BLOCKS]; /* Home sector of each block. */
+	uint8_t unused[DISK_SECTOR_SIZE - 3 * sizeof (uint32_t)
+		- JOURNAL_BLOCKS * sizeof (disk_sector_t)];
+};
+
+/* JOURNAL_LOCK protects everything below and serializes commits.
+ * HANDLES_DONE is signaled when a handle ends or a commit finishes. */
+static struct lock journal_lock;
+static struct condition handles_done;
+static int handle_cnt;                  /* Open handles. */
+static bool commit_wanted;              /* journal_commit() waiting. */
+static bool enabled;                    /* Set once recovery is done. */
+static uint32_t next_seq;               /* Number of the next commit. */
+static struct journal_header *header;
+static uint8_t *block;                  /* Bounce buffer for one block. */
+
+/* Statistics. */
+static long long commit_cnt;            /* Transactions committed. */
+static long long logged_cnt;            /* Blocks written to the journal. */
+static long long replay_cnt;            /* Blocks replayed at startup. */
+
+static void commit_daemon (void *aux);
+
+/* Returns the number of metadata blocks waiting for a commit. */
+static size_t
+pending_cnt (void) {
+	size_t cnt = buffer_cache_journaled (NULL, 0);
+#ifdef EFILESYS
+	cnt += fat_dirty_sectors (NULL, 0);
+#endif
+	return cnt;
+}
+
+/* Copies the blocks of the committed transaction in HEADER to their
+ * home sectors and clears the header. */
+static void
+replay (void) {
+	for (uint32_t i = 0; i < header->cnt; i++) {
+		disk_read (filesys_disk, JOURNAL_SECTOR + 1 + i, block);
+		disk_write (filesys_disk, header->home[i], block);
+	}
+	replay_cnt += header->cnt;
+	header->cnt = 0;
+	disk_write (filesys_disk, JOURNAL_SECTOR, header);
+}
+
+/* Initializes the journal.  If FORMAT is true, the journal region is
+ * cleared; otherwise a transaction committed before a crash is
+ * replayed.  Must run before the file system reads any metadata. */
+void
+journal_init (bool format) {
+	ASSERT (sizeof *header == DISK_SECTOR_SIZE);
+
+	lock_init (&journal_lock);
+	cond_init (&handles_done);
+	header = malloc (sizeof *header);
+	block = malloc (DISK_SECTOR_SIZE);
+	if (header == NULL || block == NULL)
+		PANIC ("journal: out of memory");
+
+	if (format)
+		memset (header, 0, sizeof *header);
+	else
+		disk_read (filesys_disk, JOURNAL_SECTOR, header);
+	if (header->magic != JOURNAL_MAGIC) {
+		memset (header, 0, sizeof *header);
+		header->magic = JOURNAL_MAGIC;
+		disk_write (filesys_disk, JOURNAL_SECTOR, header);
+	} else if (header->cnt > 0 && header->cnt <= JOURNAL_BLOCKS)
+		replay ();
+	next_seq = header->seq + 1;
+
+	enabled = true;
+	if (thread_create ("jnl-commit", PRI_DEFAULT, commit_daemon, NULL)
+			== TID_ERROR)
+		PANIC ("journal: cannot start commit daemon");
+}
+
+/* Commits the pending metadata blocks, if any.  JOURNAL_LOCK must be
+ * held and no handle may be open.  journal_begin() keeps a batch
+ * within JOURNAL_BLOCKS, so every batch is logged. */
+static void
+commit (void) {
+	size_t cnt = 0, fat_cnt = 0;
+
+	ASSERT (lock_held_by_current_thread (&journal_lock));
+	ASSERT (handle_cnt == 0);
+
+#ifdef EFILESYS
+	fat_cnt = fat_dirty_sectors (header->home, JOURNAL_BLOCKS);
+	ASSERT (fat_cnt <= JOURNAL_BLOCKS);
+#endif
+	cnt = fat_cnt + buffer_cache_journaled (header->home + fat_cnt,
+			JOURNAL_BLOCKS - fat_cnt);
+	ASSERT (cnt <= JOURNAL_BLOCKS);
+	if (cnt == 0)
+		return;
+
+	/* Log the blocks, then commit them with the header. */
+	for (size_t i = 0; i < cnt; i++) {
+#ifdef EFILESYS
+		if (i < fat_cnt)
+			fat_copy_sector (header->home[i], block);
+		else
+#endif
+			buffer_cache_read (header->home[i], block, 0, DISK_SECTOR_SIZE);
+		disk_write (filesys_disk, JOURNAL_SECTOR + 1 + i, block);
+	}
+	header->seq = next_seq++;
+	header->cnt = cnt;
+	disk_write (filesys_disk, JOURNAL_SECTOR, header);
+	commit_cnt++;
+	logged_cnt += cnt;
+
+	/* Checkpoint. */
+	buffer_cache_checkpoint ();
+#ifdef EFILESYS
+	fat_flush ();
+#endif
+	header->cnt = 0;
+	disk_write (filesys_disk, JOURNAL_SECTOR, header);
+}
+
+/* Returns true if enough blocks are pending to commit them. */
+static bool
+commit_due (void) {
+	return pending_cnt () >= COMMIT_THRESHOLD;
+}
+
+/* Returns true if one more handle, on top of the open ones, cannot
+ * overflow the journal or the buffer cache.  This holds whenever no
+ * commit is due, by the checks above; it is checked anyway, so that a
+ * batch never outgrows the cache even if a handle is bigger than it
+ * should be. */
+static bool
+room_for_handle (void) {
+	size_t need = (handle_cnt + 1) * HANDLE_BLOCKS;
+
+	return pending_cnt () + need <= JOURNAL_BLOCKS
+		&& buffer_cache_journaled (NULL, 0) + need
+			<= BUFFER_CACHE_JOURNALED_MAX;
+}
+
+/* Opens a handle: the metadata changes made until the matching
+ * journal_end() reach the disk together or not at all.  Handles
+ * nest; only the outermost one counts.  If the pending blocks leave
+ * no room for another handle, waits for them to be committed: a commit
+ * cannot happen while any handle is open, so this is the only place
+ * to wait for one. */
+void
+journal_begin (void) {
+	struct thread *t = thread_current ();
+
+	if (!enabled || t->journal_depth++ > 0)
+		return;
+
+	lock_acquire (&journal_lock);
+	while (handle_cnt >= MAX_HANDLES || commit_wanted
+			|| (handle_cnt > 0 && (commit_due () || !room_for_handle ())))
+		cond_wait (&handles_done, &journal_lock);
+	if (commit_due () || !room_for_handle ())
+		commit ();
+	handle_cnt++;
+	lock_release (&journal_lock);
+}
+
+/* Closes the handle opened by journal_begin().  The last handle to
+ * end commits if enough blocks are pending. */
+void
+journal_end (void) {
+	struct thread *t = thread_current ();
+
+	if (!enabled)
+		return;
+	ASSERT (t->journal_depth > 0);
+	if (--t->journal_depth > 0)
+		return;
+
+	lock_acquire (&journal_lock);
+	if (--handle_cnt == 0 && !commit_wanted && commit_due ())
+		commit ();
+	cond_broadcast (&handles_done, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Writes SIZE bytes from BUFFER to byte SECTOR_OFS of metadata
+ * sector SECTOR, as part of the current handle.  Outside one, the
+ * write is a handle of its own. */
+void
+journal_write (disk_sector_t sector, const void *buffer, int sector_ofs,
+		int size) {
+	if (!enabled) {
+		buffer_cache_write (sector, buffer, sector_ofs, size);
+		return;
+	}
+	journal_begin ();
+	buffer_cache_write_journaled (sector, buffer, sector_ofs, size);
+	journal_end ();
+}
+
+/* Sets metadata sector SECTOR to all zeros, like journal_write(). */
+void
+journal_zero (disk_sector_t sector) {
+	if (!enabled) {
+		buffer_cache_zero (sector);
+		return;
+	}
+	journal_begin ();
+	buffer_cache_zero_journaled (sector);
+	journal_end ();
+}
+
+/* Commits every metadata change made so far.  Waits for the open
+ * handles to end, keeping new ones out meanwhile.  Must not be called
+ * inside a handle. */
+void
+journal_commit (void) {
+	if (!enabled)
+		return;
+	ASSERT (thread_current ()->journal_depth == 0);
+
+	lock_acquire (&journal_lock);
+	while (commit_wanted)
+		cond_wait (&handles_done, &journal_lock);
+	commit_wanted = true;
+	while (handle_cnt > 0)
+		cond_wait (&handles_done, &journal_lock);
+	commit ();
+	commit_wanted = false;
+	cond_broadcast (&handles_done, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Commits what is left at shutdown. */
+void
+journal_done (void) {
+	journal_commit ();
+}
+
+/* Commits every COMMIT_INTERVAL ticks, so that a crash loses at most
+ * that much work. */
+static void
+commit_daemon (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (COMMIT_INTERVAL);
+		journal_commit ();
+	}
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void) {
+	printf ("Journal: %lld commits, %lld blocks logged, %lld blocks replayed\n",
+			commit_cnt, logged_cnt, replay_cnt);
+}
@@ -0,0 +1,30 @@
+#ifndef FILESYS_BUFFER_CACHE_H
+#define FILESYS_BUFFER_CACHE_H
+
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Number of sectors the buffer cache holds. */
+#define BUFFER_CACHE_SIZE 64
+
+/* Most sectors the journal may keep pinned in the cache at once.  The
+ * rest stay free for file data and for I/O in progress, so that an
+ * eviction always finds a victim in the end. */
+#define BUFFER_CACHE_JOURNALED_MAX (BUFFER_CACHE_SIZE - 4)
+
+void buffer_cache_init (void);
+void buffer_cache_read (disk_sector_t, void *, int sector_ofs, int size);
+void buffer_cache_write (disk_sector_t, const void *, int sector_ofs,
+		int size);
+void buffer_cache_zero (disk_sector_t);
+void buffer_cache_write_journaled (disk_sector_t, const void *,
+		int sector_ofs, int size);
+void buffer_cache_zero_journaled (disk_sector_t);
+size_t buffer_cache_journaled (disk_sector_t *, size_t max);
+void buffer_cache_checkpoint (void);
+void buffer_cache_prefetch (disk_sector_t);
+void buffer_cache_flush (void);
+void buffer_cache_done (void);
+void buffer_cache_print_stats (void);
+
+#endif /* filesys/buffer-cache.h */
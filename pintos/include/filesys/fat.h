@@ -17,6 +17,7 @@ typedef uint32_t cluster_t;  /* Index of a cluster within FAT. */
 #define SECTORS_PER_CLUSTER 1 /* Number of sectors per cluster */
 #define FAT_BOOT_SECTOR 0     /* FAT boot sector. */
 #define ROOT_DIR_CLUSTER 1    /* Cluster for the root directory */
+#define JOURNAL_CLUSTER 2     /* First cluster of the journal */
 
 void fat_init (void);
 void fat_open (void);
@@ -34,5 +35,12 @@ void fat_remove_chain (
 cluster_t fat_get (cluster_t clst);
 void fat_put (cluster_t clst, cluster_t val);
 disk_sector_t cluster_to_sector (cluster_t clst);
+cluster_t sector_to_cluster (disk_sector_t sector);
+void fat_print_stats (void);
+
+/* Journal support. */
+size_t fat_dirty_sectors (disk_sector_t *, size_t max);
+void fat_copy_sector (disk_sector_t, void *);
+void fat_flush (void);
 
 #endif /* filesys/fat.h */
@@ -6,7 +6,16 @@
 
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
+#ifdef EFILESYS
+#include "filesys/fat.h"
+/* Root directory file inode sector: the root directory cluster. */
+#define ROOT_DIR_SECTOR (cluster_to_sector (ROOT_DIR_CLUSTER))
+/* First sector of the journal region: the journal clusters. */
+#define JOURNAL_SECTOR (cluster_to_sector (JOURNAL_CLUSTER))
+#else
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /* First sector of the journal region. */
+#endif
 
 /* Disk used for file system. */
 extern struct disk *filesys_disk;
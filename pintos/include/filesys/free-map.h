@@ -12,6 +12,13 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, disk_sector_t *);
+bool free_map_allocate_near (size_t, disk_sector_t near, disk_sector_t *);
 void free_map_release (disk_sector_t, size_t);
 
+#ifndef EFILESYS
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
+bool free_map_allocate_reserved (disk_sector_t near, disk_sector_t *);
+#endif
+
 #endif /* filesys/free-map.h */
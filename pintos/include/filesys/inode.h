@@ -16,8 +16,14 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
+void inode_flush_delayed (void);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+unsigned inode_write_gen (const struct inode *);
+void inode_set_journaled (struct inode *);
+void *inode_get_private (const struct inode *);
+void inode_set_private (struct inode *, void *, void (*destroy) (void *));
 
 #endif /* filesys/inode.h */
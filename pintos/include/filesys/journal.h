@@ -0,0 +1,19 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+/* Sectors in the journal region: a header, then the logged blocks. */
+#define JOURNAL_SECTORS 64
+
+void journal_init (bool format);
+void journal_begin (void);
+void journal_end (void);
+void journal_write (disk_sector_t, const void *, int sector_ofs, int size);
+void journal_zero (disk_sector_t);
+void journal_commit (void);
+void journal_done (void);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
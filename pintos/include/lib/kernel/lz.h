@@ -0,0 +1,32 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+/* Small, fast LZ77 compressor.
+ *
+ * The output is a series of sequences, each a token byte, a run of
+ * literal bytes, and a back reference of at least LZ_MIN_MATCH bytes
+ * into the last 64 kB of output; the last sequence has literals
+ * only.  The format follows LZ4's block format, which trades ratio
+ * for speed: compressing a page costs about as much as copying it a
+ * few times, far less than writing it to disk. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Shortest back reference. */
+#define LZ_MIN_MATCH 4
+
+/* Hash table of recent positions used by lz_compress().  It is too
+ * big for a kernel stack, so callers supply one. */
+#define LZ_HASH_BITS 10
+struct lz_state {
+	uint16_t table[1 << LZ_HASH_BITS];
+};
+
+size_t lz_compress (const void *src, size_t src_len, void *dst,
+		size_t dst_cap, struct lz_state *);
+bool lz_decompress (const void *src, size_t src_len, void *dst,
+		size_t dst_len);
+
+#endif /* lib/kernel/lz.h */
@@ -36,6 +36,14 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Extra: fork + exec without duplicating the address space. */
+	SYS_SPAWN,                  /* Start a new process from a command line. */
+	SYS_WAITANY,                /* Wait for any child process to die. */
+
+	/* Extra: per-process memory accounting (VM only). */
+	SYS_MEMSTAT,                /* Report a process's memory usage. */
+	SYS_SET_RSS_LIMIT,          /* Set the resident set soft limit. */
 };
 
 #endif /* lib/syscall-nr.h */
@@ -16,6 +16,16 @@ typedef int off_t;
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/* Memory usage of a process, in pages, filled in by memstat(). */
+struct memstat
+{
+    size_t rss;       /* Resident pages. */
+    size_t swapped;   /* Anonymous pages in swap. */
+    size_t shared;    /* Resident pages shared with a fork relative. */
+    size_t ws;        /* Working set estimate. */
+    size_t rss_limit; /* Resident set soft limit, 0 if none. */
+};
+
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0 /* Successful execution. */
 #define EXIT_FAILURE 1 /* Unsuccessful execution. */
@@ -37,10 +47,14 @@ unsigned tell(int fd);
 void close(int fd);
 
 int dup2(int oldfd, int newfd);
+pid_t spawn(const char *cmd_line);
+pid_t waitany(int *status);
 
 /* Project 3 and optionally project 4. */
 void *mmap(void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap(void *addr);
+int memstat(pid_t pid, struct memstat *stat);
+size_t set_rss_limit(size_t pages);
 
 /* Project 4 only. */
 bool chdir(const char *dir);
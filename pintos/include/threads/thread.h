@@ -2,6 +2,7 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
 #include "threads/interrupt.h"
@@ -144,13 +145,16 @@ struct thread
     int nice;        // Nice 값 (-20 ~ 20)
     int recent_cpu;  // 최근 CPU 사용량 (고정소수점) (17.14)
 
-    struct list child_info_list;  // 자식 프로세스 관리를 위한 리스트
-    struct child_info* my_info;   // 자신이 자식을때 정보를 담기 위한 구조체
+    struct hash child_table;           // 자식 프로세스 관리를 위한 해시 테이블 (키: tid)
+    struct list exited_children;       // 종료했지만 아직 회수되지 않은 자식들 (종료 순서)
+    struct semaphore child_exit_sema;  // 자식이 종료될 때마다 up
+    struct child_info* my_info;        // 자신이 자식을때 정보를 담기 위한 구조체
     int exit_status;
 
     // 파일 관리
     struct file** fds;       // 파일 디스크립터
     struct file* exec_file;  // 실행 중인 파일 (deny write용)
+    int journal_depth;       // 열려 있는 저널 핸들 중첩 깊이 (filesys/journal.c)
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem; /* List element. */
@@ -167,6 +171,8 @@ struct thread
     /* Table for whole virtual memory owned by thread. */
     struct supplemental_page_table spt;
     /* 보조 페이지 테이블. */
+    uintptr_t user_rsp; /* 시스템 콜 진입 시의 사용자 rsp (커널 모드 폴트의 스택 성장 판단용) */
+    bool swap_reading_ahead; /* 스왑 인 미리 읽기 중 (vm/anon.c). 미리 읽는 이웃이 또 미리 읽지 않도록 */
 #endif
 
     /* Owned by thread.c. */
@@ -9,7 +9,10 @@ struct child_info
     tid_t tid;                   // 자식의 TID
     int exit_status;             // 종료 상태 (초기값: 불확실하면 -1 등)
     struct semaphore wait_sema;  // 대기용 세마포어
-    struct list_elem elem;       // 부모의 children 리스트 연결용
+    struct hash_elem elem;       // 부모의 child_table 연결용 (키: tid)
+    struct list_elem exit_elem;  // 부모의 exited_children 연결용
+    struct thread *parent;       // 부모 (부모가 먼저 종료되면 NULL)
+    int ref_cnt;                 // 부모/자식 중 아직 참조 중인 쪽 수
 };
 
 /* 프로세스의 fork시 생성을 위한 구조체. */
@@ -22,11 +25,29 @@ struct fork_data
     struct child_info *child_info;
 };
 
+/* 프로세스의 spawn시 생성을 위한 구조체. */
+struct spawn_data
+{
+    struct thread *parent;
+    char *fn_copy;                 // 실행할 명령줄 (부모의 커널 스택)
+    struct semaphore child_load;   // 자식의 load 완료 알림
+    bool success;
+    struct child_info *child_info;
+};
+
 tid_t process_create_initd(const char *file_name);
 tid_t process_fork(const char *name, struct intr_frame *if_);
+tid_t process_spawn(const char *cmd_line);
 int process_exec(void *f_name);
 int process_wait(tid_t);
+tid_t process_wait_any(int *status);
+bool process_child_table_init(struct thread *t);
 void process_exit(void);
 void process_activate(struct thread *next);
+#ifndef VM
+bool process_handle_cow(const void *addr);
+void process_print_stats(void);
+void exec_cache_init(void);
+#endif
 
 #endif /* userprog/process.h */
@@ -1,13 +1,26 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <stddef.h>
 #include "vm/vm.h"
 struct page;
 enum vm_type;
 
+/* Marks an anonymous page that has no swap slot. */
+#define SWAP_SLOT_NONE ((size_t) -1)
+
+/* Most pages written to swap in one clustered pass. */
+#define SWAP_CLUSTER 8
+
 struct anon_page {
+	size_t slot;                /* Swap slot, or SWAP_SLOT_NONE. */
+	struct zswap_entry *zentry; /* Compressed copy, or NULL. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+size_t anon_swap_out_cluster (struct page **pages, size_t cnt);
+bool anon_is_swapped (const struct page *page);
+void anon_share_slot (struct page *src, struct page *dst);
+void vm_anon_print_stats (void);
 
 #endif
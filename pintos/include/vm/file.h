@@ -5,12 +5,21 @@
 
 struct page;
 enum vm_type;
+struct mmap_file;
+struct spt_region;
+struct supplemental_page_table;
 
 struct file_page {
+	struct mmap_file *map;      /* Mapping the page belongs to. */
+	off_t ofs;                  /* File offset of the page's first byte. */
+	size_t read_bytes;          /* Bytes backed by the file; rest is zero. */
 };
 
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
+void vm_file_readahead (struct page *page);
+bool mmap_copy_region (struct supplemental_page_table *dst,
+		const struct spt_region *src);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
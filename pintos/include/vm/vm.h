@@ -1,6 +1,7 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -36,6 +37,9 @@ struct thread;
 
 #define VM_TYPE(type) ((type) & 7)
 
+/* Marks the pages that make up a user stack. */
+#define VM_STACK VM_MARKER_0
+
 /* The representation of "page".
  * This is kind of "parent class", which has four "child class"es, which are
  * uninit_page, file_page, anon_page, and page cache (project4).
@@ -46,6 +50,10 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct hash_elem spt_elem;  /* Element in supplemental_page_table. */
+	bool writable;              /* Writable by the user process? */
+	struct thread *owner;       /* Process whose pml4 maps this page. */
+	struct list_elem frame_elem;  /* Element in frame's PAGES list. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -62,7 +70,15 @@ struct page {
 /* The representation of "frame" */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct page *page;          /* First of PAGES, or NULL if unused. */
+	struct list pages;          /* Pages mapping this frame.  More than
+	                               one only after a copy-on-write fork,
+	                               and then every mapping is read-only. */
+	size_t ref_cnt;             /* Number of PAGES. */
+	struct list_elem elem;      /* Element in the global frame table. */
+	unsigned pin_cnt;           /* Not evictable while nonzero: being
+	                               filled, evicted or written back. */
+	bool evicting;              /* Being written out by an eviction. */
 };
 
 /* The function table for page operations.
@@ -81,10 +97,62 @@ struct page_operations {
 #define destroy(page) \
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
+/* Kinds of contiguous user regions tracked by the region index. */
+enum spt_region_type {
+	REGION_SEGMENT,       /* PT_LOAD segment of the executable. */
+	REGION_MMAP,          /* mmap()ed file. */
+	REGION_STACK,         /* User stack. */
+};
+
+/* A contiguous run of user pages [START, END) that was set up as a
+ * unit.  Regions never overlap each other. */
+struct spt_region {
+	void *start;                /* First page (page aligned). */
+	void *end;                  /* One past the last page (page aligned). */
+	enum spt_region_type type;
+	void *aux;                  /* Owner data, e.g. the mmap_file. */
+	off_t ofs;                  /* REGION_SEGMENT: file offset of START. */
+	off_t file_bytes;           /* REGION_SEGMENT: bytes read from the
+	                               executable; the rest is zero. */
+};
+
 /* Representation of current process's memory space.
- * We don't want to force you to obey any specific design for this struct.
- * All designs up to you for this. */
+ * Pages are hashed by their page-aligned user address, so fault-time
+ * lookup is O(1).  REGIONS is a second index, kept sorted by start
+ * address, over the regions the pages were created for; overlap and
+ * containment checks binary-search it instead of probing every page.
+ *
+ * The page counts below are kept up to date as frames are linked and
+ * swap is used, so they can be reported for any process without
+ * walking its table.  RSS, SHARED and the working set fields are
+ * protected by the frame lock, SWAPPED by the swap lock. */
 struct supplemental_page_table {
+	struct hash pages;              /* struct page, keyed on va. */
+	struct spt_region *regions;     /* Sorted by start, non-overlapping. */
+	size_t region_cnt;              /* Number of regions in use. */
+	size_t region_cap;              /* Allocated slots in REGIONS. */
+
+	size_t rss;                     /* Pages with a frame. */
+	size_t shared;                  /* Of those, frames shared by fork. */
+	size_t swapped;                 /* Anonymous pages in swap. */
+	size_t rss_limit;               /* Soft limit in pages, or 0 for the
+	                                   default, vm_rss_limit.  Kept
+	                                   across exec, inherited by fork. */
+	size_t ws;                      /* Working set estimate in pages. */
+	size_t ws_seen;                 /* Pages sampled in this round. */
+	size_t ws_hits;                 /* Of those, recently accessed. */
+	bool listed;                    /* In the process list? */
+	struct list_elem elem;          /* Element in the process list. */
+};
+
+/* Memory usage of one process, as reported by vm_memstat().  Counts
+ * are in pages.  Same layout as struct memstat in user space. */
+struct vm_memstat {
+	size_t rss;                     /* Resident pages. */
+	size_t swapped;                 /* Anonymous pages in swap. */
+	size_t shared;                  /* Resident pages shared by fork. */
+	size_t ws;                      /* Working set estimate. */
+	size_t rss_limit;               /* Soft limit, 0 if none. */
 };
 
 #include "threads/thread.h"
@@ -96,6 +164,22 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+struct spt_region *spt_region_insert (struct supplemental_page_table *spt,
+		void *start, void *end, enum spt_region_type type, void *aux);
+void spt_region_remove (struct supplemental_page_table *spt, void *start);
+struct spt_region *spt_region_find (struct supplemental_page_table *spt,
+		const void *va);
+bool spt_region_overlaps (struct supplemental_page_table *spt,
+		const void *start, const void *end);
+
+/* Largest size, in bytes, a user stack may grow to. */
+extern size_t vm_stack_limit;
+
+/* Default resident set soft limit in pages, 0 for none. */
+extern size_t vm_rss_limit;
+
+/* Whether evicted anonymous pages may be kept compressed in memory. */
+extern bool vm_zswap;
 
 void vm_init (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
@@ -107,6 +191,15 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+void vm_frame_free (struct page *page);
+void *vm_frame_pin (struct page *page);
+void vm_frame_unpin (struct page *page);
+bool vm_prefetch_page (struct page *page);
+bool vm_prepare_write (struct page *page);
+struct page *vm_lookup_page (void *va);
+void vm_print_stats (void);
+bool vm_memstat (int pid, struct vm_memstat *stat);
+size_t vm_set_rss_limit (size_t pages);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
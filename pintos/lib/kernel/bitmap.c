@@ -326,6 +326,17 @@ bitmap_write (const struct bitmap *b, struct file *file) {
 	off_t size = byte_cnt (b->bit_cnt);
 	return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes SIZE bytes of B, starting at byte OFS of its file image, to
+   the same place in FILE.  Return true if successful, false
+   otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+		size_t ofs, size_t size) {
+	ASSERT (ofs + size <= byte_cnt (b->bit_cnt));
+	return file_write_at (file, (uint8_t *) b->bits + ofs, size, ofs)
+		== (off_t) size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,167 @@
+/* LZ77 compression in LZ4's block format.
+
+   See lz.h for basic information.
+
+   A token byte holds the literal count in its high nibble and the
+   match length minus LZ_MIN_MATCH in its low nibble.  A nibble of 15
+   means the count continues in following bytes, each added to it,
+   until one below 255.  The literals follow the token (after any
+   literal count bytes), then a 2-byte little-endian match offset,
+   then any match length bytes. */
+
+#include "lz.h"
+#include <string.h>
+#include "../debug.h"
+
+/* Reads 4 unaligned bytes at P. */
+static uint32_t
+read32 (const uint8_t *p) {
+	uint32_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+/* Hash of the 4 bytes V, for struct lz_state's table. */
+static unsigned
+hash32 (uint32_t v) {
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Number of bytes needed to extend a nibble count of N. */
+static size_t
+len_bytes (size_t n) {
+	return n < 15 ? 0 : (n - 15) / 255 + 1;
+}
+
+/* Writes the extension bytes for nibble count N at OP and returns
+   the new end of output. */
+static uint8_t *
+put_len (uint8_t *op, size_t n) {
+	if (n < 15)
+		return op;
+	for (n -= 15; n >= 255; n -= 255)
+		*op++ = 255;
+	*op++ = n;
+	return op;
+}
+
+/* Appends a sequence of LIT_CNT literals at LIT followed, if
+   MATCH_LEN is nonzero, by a match of MATCH_LEN bytes OFFSET bytes
+   back.  Returns the new end of output, or NULL if it would pass
+   OEND. */
+static uint8_t *
+put_sequence (uint8_t *op, uint8_t *oend, const uint8_t *lit,
+		size_t lit_cnt, size_t offset, size_t match_len) {
+	size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+	size_t need = 1 + len_bytes (lit_cnt) + lit_cnt;
+
+	if (match_len)
+		need += 2 + len_bytes (ml);
+	if (need > (size_t) (oend - op))
+		return NULL;
+
+	*op++ = (lit_cnt < 15 ? lit_cnt : 15) << 4 | (ml < 15 ? ml : 15);
+	op = put_len (op, lit_cnt);
+	memcpy (op, lit, lit_cnt);
+	op += lit_cnt;
+	if (match_len) {
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+		op = put_len (op, ml);
+	}
+	return op;
+}
+
+/* Compresses the SRC_LEN bytes at SRC, at most 65535, into the
+   DST_CAP bytes at DST, using STATE as scratch space.  Returns the
+   compressed size, or 0 if it does not fit in DST_CAP. */
+size_t
+lz_compress (const void *src_, size_t src_len, void *dst_, size_t dst_cap,
+		struct lz_state *state) {
+	const uint8_t *src = src_;
+	const uint8_t *ip = src, *anchor = src, *end = src + src_len;
+	uint8_t *dst = dst_, *op = dst, *oend = dst + dst_cap;
+
+	ASSERT (src_len <= UINT16_MAX);
+
+	memset (state->table, 0, sizeof state->table);
+	while (src_len >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH) {
+		uint32_t seq = read32 (ip);
+		unsigned h = hash32 (seq);
+		const uint8_t *ref = src + state->table[h];
+		size_t len;
+
+		state->table[h] = ip - src;
+		if (ref >= ip || read32 (ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		for (len = LZ_MIN_MATCH; ip + len < end && ref[len] == ip[len]; len++)
+			continue;
+		op = put_sequence (op, oend, anchor, ip - anchor, ip - ref, len);
+		if (op == NULL)
+			return 0;
+		ip += len;
+		anchor = ip;
+	}
+
+	op = put_sequence (op, oend, anchor, end - anchor, 0, 0);
+	return op != NULL ? (size_t) (op - dst) : 0;
+}
+
+/* Reads an extended count that starts at nibble value N from *IP,
+   not past IEND.  Returns false if the input ends first. */
+static bool
+get_len (const uint8_t **ip, const uint8_t *iend, size_t *n) {
+	uint8_t b;
+
+	if (*n < 15)
+		return true;
+	do {
+		if (*ip >= iend)
+			return false;
+		b = *(*ip)++;
+		*n += b;
+	} while (b == 255);
+	return true;
+}
+
+/* Decompresses the SRC_LEN bytes at SRC into DST.  Returns true if
+   the input was well formed and produced exactly DST_LEN bytes. */
+bool
+lz_decompress (const void *src_, size_t src_len, void *dst_, size_t dst_len) {
+	const uint8_t *ip = src_, *iend = ip + src_len;
+	uint8_t *dst = dst_, *op = dst, *oend = dst + dst_len;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t lit_cnt = token >> 4, len = token & 15, offset;
+
+		if (!get_len (&ip, iend, &lit_cnt)
+				|| lit_cnt > (size_t) (iend - ip)
+				|| lit_cnt > (size_t) (oend - op))
+			return false;
+		memcpy (op, ip, lit_cnt);
+		op += lit_cnt;
+		ip += lit_cnt;
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return false;
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (!get_len (&ip, iend, &len))
+			return false;
+		len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t) (op - dst)
+				|| len > (size_t) (oend - op))
+			return false;
+
+		/* Byte by byte: the source may overlap what is written. */
+		for (const uint8_t *ref = op - offset; len-- > 0; )
+			*op++ = *ref++;
+	}
+	return op == oend;
+}
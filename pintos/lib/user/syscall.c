@@ -179,3 +179,23 @@ int umount(const char *path)
 {
     return syscall1(SYS_UMOUNT, path);
 }
+
+pid_t spawn(const char *cmd_line)
+{
+    return (pid_t)syscall1(SYS_SPAWN, cmd_line);
+}
+
+pid_t waitany(int *status)
+{
+    return (pid_t)syscall1(SYS_WAITANY, status);
+}
+
+int memstat(pid_t pid, struct memstat *stat)
+{
+    return syscall2(SYS_MEMSTAT, pid, stat);
+}
+
+size_t set_rss_limit(size_t pages)
+{
+    return (size_t)syscall1(SYS_SET_RSS_LIMIT, pages);
+}
@@ -0,0 +1,47 @@
+/* Forks several children that exit with different codes and reaps
+   them with waitany().  Each child must be returned exactly once,
+   with its own exit code, and then waitany() must return -1. */
+
+#include <stdbool.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 3
+
+void
+test_main (void)
+{
+  pid_t pids[CHILD_CNT];
+  bool reaped[CHILD_CNT];
+  int i, j;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      pids[i] = fork ("child");
+      if (pids[i] == 0)
+        exit (80 + i);
+      CHECK (pids[i] > 0, "fork child %d", i);
+      reaped[i] = false;
+    }
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      int status;
+      pid_t pid = waitany (&status);
+
+      for (j = 0; j < CHILD_CNT; j++)
+        if (pids[j] == pid)
+          break;
+      if (j == CHILD_CNT)
+        fail ("waitany() returned %d, not one of the children", pid);
+      if (reaped[j])
+        fail ("waitany() returned child %d twice", j);
+      if (status != 80 + j)
+        fail ("child %d exited with %d, not %d", j, status, 80 + j);
+      reaped[j] = true;
+    }
+  msg ("reaped %d children", CHILD_CNT);
+
+  CHECK (waitany (NULL) == -1, "waitany() with no children left");
+}
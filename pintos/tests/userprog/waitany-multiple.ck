@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(waitany-multiple) begin
+(waitany-multiple) fork child 0
+(waitany-multiple) fork child 1
+(waitany-multiple) fork child 2
+(waitany-multiple) reaped 3 children
+(waitany-multiple) waitany() with no children left
+(waitany-multiple) end
+EOF
+pass;
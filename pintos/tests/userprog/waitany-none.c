@@ -0,0 +1,15 @@
+/* Calls waitany() in a process without children.
+   It must return -1 and leave the status alone. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int status = 1234;
+
+  msg ("waitany(&status) = %d", waitany (&status));
+  msg ("status = %d", status);
+}
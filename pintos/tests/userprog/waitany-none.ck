@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(waitany-none) begin
+(waitany-none) waitany(&status) = -1
+(waitany-none) status = 1234
+(waitany-none) end
+waitany-none: exit(0)
+EOF
+pass;
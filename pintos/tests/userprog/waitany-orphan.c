@@ -0,0 +1,61 @@
+/* A child forks two grandchildren and exits before they do.
+   waitany() in the test process must return only the child, not
+   the grandchildren, and the grandchildren must still run to the
+   end after losing their parent: each creates a file when it is
+   done, which the test process waits to see. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define GRANDCHILD_CNT 2
+
+/* Spins long enough that the grandchild's parent exits first. */
+static void
+spin (void)
+{
+  volatile int i;
+
+  for (i = 0; i < 10000000; i++)
+    continue;
+}
+
+void
+test_main (void)
+{
+  char name[16];
+  pid_t pid;
+  int status;
+  int i;
+
+  pid = fork ("child");
+  if (pid == 0)
+    {
+      for (i = 0; i < GRANDCHILD_CNT; i++)
+        if (fork ("grandchild") == 0)
+          {
+            spin ();
+            snprintf (name, sizeof name, "orphan-%d", i);
+            create (name, 0);
+            exit (0);
+          }
+      exit (81);
+    }
+  CHECK (pid > 0, "fork child");
+
+  CHECK (waitany (&status) == pid, "waitany() returns the child");
+  msg ("child exited with %d", status);
+  CHECK (waitany (NULL) == -1, "waitany() does not return grandchildren");
+
+  for (i = 0; i < GRANDCHILD_CNT; i++)
+    {
+      int fd;
+
+      snprintf (name, sizeof name, "orphan-%d", i);
+      while ((fd = open (name)) < 0)
+        continue;
+      close (fd);
+      msg ("grandchild %d finished", i);
+    }
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(waitany-orphan) begin
+(waitany-orphan) fork child
+(waitany-orphan) waitany() returns the child
+(waitany-orphan) child exited with 81
+(waitany-orphan) waitany() does not return grandchildren
+(waitany-orphan) grandchild 0 finished
+(waitany-orphan) grandchild 1 finished
+(waitany-orphan) end
+EOF
+pass;
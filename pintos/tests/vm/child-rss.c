@@ -0,0 +1,41 @@
+/* Child process run by the rss-limit test.
+   Sets a resident set soft limit, touches a buffer much bigger than
+   that, and creates "rss-ready".  Then waits for "rss-done", which
+   the parent creates after pushing this process down to its limit,
+   and checks that the buffer survived being swapped out. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+/* Must match tests/vm/rss-limit.c. */
+#define CHILD_PAGES 256
+#define RSS_LIMIT 32
+
+#define PAGE_SIZE 4096
+
+static char buf[CHILD_PAGES * PAGE_SIZE];
+
+int
+main (void)
+{
+  size_t i;
+  int fd;
+
+  test_name = "child-rss";
+
+  set_rss_limit (RSS_LIMIT);
+  for (i = 0; i < CHILD_PAGES; i++)
+    memset (buf + i * PAGE_SIZE, (char) i, PAGE_SIZE);
+  create ("rss-ready", 0);
+
+  while ((fd = open ("rss-done")) < 0)
+    continue;
+  close (fd);
+
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != (char) (i / PAGE_SIZE))
+      fail ("byte %zu is %d, not %d", i, buf[i], (char) (i / PAGE_SIZE));
+  msg ("buffer intact");
+  return 0;
+}
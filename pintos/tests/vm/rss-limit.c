@@ -0,0 +1,57 @@
+/* Checks memstat() and the resident set soft limit.
+
+   child-rss sets its limit well below the size of a buffer it
+   touches.  memstat() must report the limit and the whole buffer
+   resident.  The test then touches more memory than there is, and
+   since the child is over its limit, eviction must take the child's
+   frames first: afterward the child has no more pages resident than
+   its limit, give or take a page or two it faulted back in, and the
+   rest are in swap. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Must match tests/vm/child-rss.c. */
+#define CHILD_PAGES 256
+#define RSS_LIMIT 32
+
+/* Pages the child may have faulted back in since it was evicted. */
+#define SLACK 2
+
+static char big[6 * 1024 * 1024];
+
+void
+test_main (void)
+{
+  struct memstat st;
+  pid_t pid;
+  int fd;
+
+  CHECK ((pid = spawn ("child-rss")) > 0, "spawn \"child-rss\"");
+  while ((fd = open ("rss-ready")) < 0)
+    continue;
+  close (fd);
+
+  CHECK (memstat (pid, &st) == 0, "memstat(child)");
+  if (st.rss_limit != RSS_LIMIT)
+    fail ("rss_limit is %zu, not %d", st.rss_limit, RSS_LIMIT);
+  if (st.rss < CHILD_PAGES)
+    fail ("rss is %zu, less than the %d pages touched", st.rss,
+          CHILD_PAGES);
+  msg ("child has its buffer resident");
+
+  msg ("touch %zu kB", sizeof big / 1024);
+  memset (big, 0x5a, sizeof big);
+
+  CHECK (memstat (pid, &st) == 0, "memstat(child)");
+  if (st.rss > RSS_LIMIT + SLACK)
+    fail ("rss is %zu, over the limit of %d", st.rss, RSS_LIMIT);
+  if (st.swapped == 0)
+    fail ("no pages swapped out");
+  msg ("child is within its limit");
+
+  CHECK (create ("rss-done", 0), "create \"rss-done\"");
+  msg ("wait(child) = %d", wait (pid));
+}
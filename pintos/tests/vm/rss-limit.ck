@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rss-limit) begin
+(rss-limit) spawn "child-rss"
+(rss-limit) memstat(child)
+(rss-limit) child has its buffer resident
+(rss-limit) touch 6144 kB
+(rss-limit) memstat(child)
+(rss-limit) child is within its limit
+(rss-limit) create "rss-done"
+(child-rss) buffer intact
+child-rss: exit(0)
+(rss-limit) wait(child) = 0
+(rss-limit) end
+rss-limit: exit(0)
+EOF
+pass;
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(zswap-on) begin
+(zswap-on) write pass
+(zswap-on) read pass
+(zswap-on) end
+EOF
+our ($test);
+my ($writes);
+foreach (read_text_file ("$test.output")) {
+    $writes = $1 if /^hd1:1: \d+ reads, (\d+) writes$/;
+}
+fail "swap disk statistics missing from output\n" if !defined $writes;
+fail "$writes sectors written to the swap disk with zswap on, expected fewer than 1024\n"
+  if $writes >= 1024;
+pass;
@@ -0,0 +1,33 @@
+/* Touches more anonymous memory than fits in RAM, filling each page
+   with a single byte value so that every page compresses well, then
+   checks that all of it reads back intact.
+
+   Built as zswap-on and zswap-off, which differ only in whether the
+   kernel runs with -no-zswap.  Their .ck files compare the number of
+   sectors written to the swap disk: with the zswap tier on, evicted
+   pages should stay compressed in memory and hardly any should reach
+   the disk. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT (6 * 1024 * 1024 / PAGE_SIZE)
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+
+  msg ("write pass");
+  for (i = 0; i < PAGE_CNT; i++)
+    memset (buf + i * PAGE_SIZE, (char) i, PAGE_SIZE);
+
+  msg ("read pass");
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != (char) (i / PAGE_SIZE))
+      fail ("byte %zu is %d, not %d", i, buf[i], (char) (i / PAGE_SIZE));
+}
@@ -34,8 +34,10 @@
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "filesys/buffer-cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/journal.h"
 #endif
 
 /* Page-map-level-4 with kernel mappings only. */
@@ -99,6 +101,9 @@ int main(void)
 #ifdef USERPROG
     exception_init();
     syscall_init();
+#ifndef VM
+    exec_cache_init();
+#endif
 #endif
     /* Start thread scheduler and enable interrupts. */
     thread_start();
@@ -232,6 +237,14 @@ static char **parse_options(char **argv)
             user_page_limit = atoi(value);
         else if (!strcmp(name, "-threads-tests"))
             thread_tests = true;
+#endif
+#ifdef VM
+        else if (!strcmp(name, "-sl"))
+            vm_stack_limit = (size_t)atoi(value) * 1024;
+        else if (!strcmp(name, "-rss"))
+            vm_rss_limit = (size_t)atoi(value) * 1024 / PGSIZE;
+        else if (!strcmp(name, "-no-zswap"))
+            vm_zswap = false;
 #endif
         else
             PANIC("unknown option `%s' (use -h for help)", name);
@@ -349,6 +362,11 @@ static void usage(void)
         "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
         "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+        "  -sl=KB             Limit each user stack to KB kB (default 1024).\n"
+        "  -rss=KB            Soft-limit each process to KB kB resident.\n"
+        "  -no-zswap          Swap evicted pages straight to the swap disk.\n"
 #endif
     );
     power_off();
@@ -377,10 +395,23 @@ static void print_stats(void)
     thread_print_stats();
 #ifdef FILESYS
     disk_print_stats();
+    buffer_cache_print_stats();
+    journal_print_stats();
+#ifdef EFILESYS
+    fat_print_stats();
+#endif
 #endif
     console_print_stats();
     kbd_print_stats();
 #ifdef USERPROG
     exception_print_stats();
+#ifndef VM
+    process_print_stats();
+#endif
+#endif
+    palloc_print_stats();
+#ifdef VM
+    vm_print_stats();
+    vm_anon_print_stats();
 #endif
 }
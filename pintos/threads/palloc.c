@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -43,6 +44,9 @@ struct pool
     struct lock lock; /* Mutual exclusion. */            /* 상호 배제. */
     struct bitmap *used_map; /* Bitmap of free pages. */ /* 사용 중인 페이지의 비트맵. */
     uint8_t *base; /* Base of pool. */                   /* 풀의 기본 주소. */
+    uint16_t *share_cnt;  // 페이지별 추가 공유자 수 (사용자 풀 전용, COW fork 용)
+    size_t used_cnt;      // 현재 사용 중인 페이지 수
+    size_t peak_cnt;      // 사용 중인 페이지 수의 최대값
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -333,7 +337,12 @@ uint64_t palloc_init(void)
     printf("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",  // 확장 메모리 정보 출력
            ext_mem.start, ext_mem.end, ext_mem.size / 1024);
     populate_pools(&base_mem, &ext_mem);  // 메모리 풀 채우기
-    return ext_mem.end;                   // 확장 메모리의 끝 주소 반환
+
+    /* 사용자 풀 페이지마다 공유 카운트를 둡니다. 0이면 한 곳에서만 쓰는 페이지입니다. */
+    size_t user_pages = bitmap_size(user_pool.used_map);
+    user_pool.share_cnt = palloc_get_multiple(
+        PAL_ASSERT | PAL_ZERO, DIV_ROUND_UP(user_pages * sizeof(uint16_t), PGSIZE));
+    return ext_mem.end;  // 확장 메모리의 끝 주소 반환
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -364,7 +373,13 @@ void *palloc_get_multiple(enum palloc_flags flags, size_t page_cnt)
         pages = NULL;  // 찾지 못한 경우 NULL
 
     if (pages)
-    {                                             // 페이지를 성공적으로 할당한 경우
+    {  // 페이지를 성공적으로 할당한 경우
+        /* 해제 경로(do_schedule 등)는 인터럽트가 꺼진 채로 들어오므로 통계도 인터럽트로 보호 */
+        enum intr_level old_level = intr_disable();
+        pool->used_cnt += page_cnt;
+        if (pool->used_cnt > pool->peak_cnt) pool->peak_cnt = pool->used_cnt;
+        intr_set_level(old_level);
+
         if (flags & PAL_ZERO)                     // PAL_ZERO 플래그가 설정된 경우
             memset(pages, 0, PGSIZE * page_cnt);  // 페이지를 0으로 초기화
     }
@@ -415,6 +430,17 @@ void palloc_free_multiple(void *pages, size_t page_cnt)
 
     page_idx = pg_no(pages) - pg_no(pool->base);  // 페이지 인덱스 계산
 
+    /* 다른 곳과 공유 중인 페이지라면 참조만 하나 내려놓고 실제 해제는 하지 않습니다. */
+    enum intr_level old_level = intr_disable();
+    if (pool->share_cnt != NULL && page_cnt == 1 && pool->share_cnt[page_idx] > 0)
+    {
+        pool->share_cnt[page_idx]--;
+        intr_set_level(old_level);
+        return;
+    }
+    pool->used_cnt -= page_cnt;
+    intr_set_level(old_level);
+
 #ifndef NDEBUG
     memset(pages, 0xcc,
            PGSIZE * page_cnt);  // 디버그 모드에서 해제된 메모리를 0xcc로 채움 (사용 후 사용 감지)
@@ -431,6 +457,33 @@ void palloc_free_page(void *page)
     palloc_free_multiple(page, 1);  // 단일 페이지 해제 (다중 페이지 해제 함수 호출)
 }
 
+/* 사용자 풀 페이지 PAGE에 공유자를 하나 추가합니다.
+   이후 palloc_free_page()는 공유자가 모두 내려놓을 때까지 페이지를 실제로 해제하지 않습니다. */
+void palloc_share_page(void *page)
+{
+    ASSERT(page_from_pool(&user_pool, page));
+
+    size_t page_idx = pg_no(page) - pg_no(user_pool.base);
+    enum intr_level old_level = intr_disable();
+    ASSERT(user_pool.share_cnt[page_idx] < UINT16_MAX);
+    user_pool.share_cnt[page_idx]++;
+    intr_set_level(old_level);
+}
+
+/* 사용자 풀 페이지 PAGE를 다른 곳과 공유 중이면 true를 반환합니다. */
+bool palloc_page_shared(void *page)
+{
+    if (!page_from_pool(&user_pool, page)) return false;
+    return user_pool.share_cnt[pg_no(page) - pg_no(user_pool.base)] > 0;
+}
+
+/* 페이지 풀 사용량 통계를 출력합니다. */
+void palloc_print_stats(void)
+{
+    printf("Palloc: %zu user pages in use, %zu peak; %zu kernel pages in use, %zu peak\n",
+           user_pool.used_cnt, user_pool.peak_cnt, kernel_pool.used_cnt, kernel_pool.peak_cnt);
+}
+
 /* Initializes pool P as starting at START and ending at END */
 /* 풀 P를 START에서 시작하여 END에서 끝나도록 초기화합니다 */
 static void init_pool(struct pool *p, void **bm_base, uint64_t start, uint64_t end)
@@ -448,6 +501,8 @@ static void init_pool(struct pool *p, void **bm_base, uint64_t start, uint64_t e
     lock_init(&p->lock);                                            // 풀의 락 초기화
     p->used_map = bitmap_create_in_buf(pgcnt, *bm_base, bm_pages);  // 비트맵을 버퍼에 생성
     p->base = (void *)start;                                        // 풀의 기본 주소 설정
+    p->share_cnt = NULL;
+    p->used_cnt = p->peak_cnt = 0;
 
     // Mark all to unusable.
     // 모든 페이지를 사용 불가능으로 표시합니다.
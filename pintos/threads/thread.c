@@ -243,6 +243,11 @@ tid_t thread_create(const char *name, int priority, thread_func *function, void
     {
         return TID_ERROR;
     }
+    if (!process_child_table_init(t))  // 자식 관리 테이블 (tid 해시)
+    {
+        palloc_free_page(t->fds);
+        return TID_ERROR;
+    }
     /* 표준 입출력 초기화 (값 1, 2는 STDIN_VAL, STDOUT_VAL과 같음) */
     t->fds[0] = (void *)1;
     t->fds[1] = (void *)2;
@@ -554,7 +559,6 @@ static void init_thread(struct thread *t, const char *name, int priority)
 #ifdef USERPROG
     t->fds = NULL;
     t->exec_file = NULL;
-    list_init(&t->child_info_list);
     t->exit_status = 0;
 #endif
 }
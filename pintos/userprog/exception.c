@@ -4,6 +4,8 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
 #include "intrinsic.h"
 
 /* Number of page faults processed. */
@@ -138,6 +140,11 @@ static void page_fault(struct intr_frame *f)
     /* 프로젝트 3 이상용입니다. */
     if (vm_try_handle_fault(f, fault_addr, user, write, not_present)) return;
 #endif
+#ifndef VM
+    /* COW로 공유 중인 페이지에 대한 쓰기이면 복사 후 재시도합니다. */
+    if (!not_present && write && is_user_vaddr(fault_addr) && process_handle_cow(fault_addr))
+        return;
+#endif
 
     /* 페이지 폴트를 카운트합니다. */
     page_fault_cnt++;
@@ -10,6 +10,7 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
@@ -21,6 +22,7 @@
 #include "threads/loader.h"  // LOADER_ARGS_LEN 정의
 #include "intrinsic.h"
 #include "threads/malloc.h" /* malloc() */
+#include "devices/timer.h"   /* timer_ticks() */
 
 #ifdef VM
 #include "vm/vm.h"
@@ -28,14 +30,84 @@
 
 // 정적 함수 선언들
 static void process_cleanup(void);                                // 프로세스 정리 함수
-static bool load(const char* file_name, struct intr_frame* if_);  // ELF 파일 로드 함수
+static bool load(char* cmd_line, struct intr_frame* if_);  // ELF 파일 로드 함수
 static void initd(void* f_name);  // 첫 번째 사용자 프로세스 실행 함수
 static void __do_fork(void*);     // fork 실행 함수
+static void __do_spawn(void*);    // spawn 실행 함수
+
+#ifndef VM
+/* COW(copy-on-write)로 공유 중인 PTE 표시. PTE의 OS 예약(AVL) 비트 하나를 사용합니다. */
+#define PTE_COW 0x200
+
+/* fork 통계 (process_print_stats()에서 출력) */
+static long long fork_cnt;         // fork 횟수
+static long long fork_ticks;       // process_fork()에서 보낸 총 타이머 틱
+static long long cow_shared_cnt;   // fork 시 복사하지 않고 공유한 페이지 수
+static long long cow_copied_cnt;   // 쓰기 폴트로 실제 복사한 페이지 수
+static long long cow_upgraded_cnt; // 단독 소유가 되어 복사 없이 쓰기 권한만 복구한 페이지 수
+static long long exec_hit_cnt;     // exec 캐시 적중 (디스크를 읽지 않고 매핑)
+static long long exec_miss_cnt;    // exec 캐시 미스 (ELF를 디스크에서 읽음)
+
+static void* alloc_user_page(enum palloc_flags flags);  // 사용자 페이지 할당 (부족하면 exec 캐시 비움)
+#endif
 
 /* General process initializer for initd and other process. */
 /* initd 및 다른 프로세스를 위한 일반 프로세스 초기화 함수 */
 static void process_init(void) {}
 
+/* child_table용 해시 함수: tid를 키로 사용 */
+static uint64_t child_hash(const struct hash_elem* e, void* aux UNUSED)
+{
+    const struct child_info* info = hash_entry(e, struct child_info, elem);
+    return hash_int(info->tid);
+}
+
+static bool child_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED)
+{
+    return hash_entry(a, struct child_info, elem)->tid < hash_entry(b, struct child_info, elem)->tid;
+}
+
+/* T의 자식 관리 테이블을 초기화합니다. thread_create()에서 호출됩니다. */
+bool process_child_table_init(struct thread* t)
+{
+    list_init(&t->exited_children);
+    sema_init(&t->child_exit_sema, 0);
+    return hash_init(&t->child_table, child_hash, child_less, NULL);
+}
+
+/* 현재 스레드의 자식이 될 child_info를 만듭니다.
+ * 부모와 자식이 하나씩 참조를 가지며, 둘 다 놓으면 해제됩니다. */
+static struct child_info* child_info_create(void)
+{
+    struct child_info* info = malloc(sizeof(struct child_info));
+    if (info == NULL) return NULL;
+    info->tid = TID_ERROR;  // 나중에 업데이트
+    info->exit_status = 0;
+    sema_init(&info->wait_sema, 0);
+    info->parent = thread_current();
+    info->ref_cnt = 2;
+    return info;
+}
+
+/* INFO에 대한 참조 하나를 내려놓고, 마지막 참조였으면 해제합니다. */
+static void child_info_release(struct child_info* info)
+{
+    enum intr_level old_level = intr_disable();
+    bool last = --info->ref_cnt == 0;
+    intr_set_level(old_level);
+    if (last) free(info);
+}
+
+/* 부모가 종료될 때 child_table의 각 항목에 대해 호출됩니다 (hash_destroy). */
+static void child_info_orphan(struct hash_elem* e, void* aux UNUSED)
+{
+    struct child_info* info = hash_entry(e, struct child_info, elem);
+    enum intr_level old_level = intr_disable();
+    info->parent = NULL;  // 자식이 더 이상 부모에게 알리지 않도록
+    intr_set_level(old_level);
+    child_info_release(info);
+}
+
 struct initd_args
 {
     const char* fn_copy;
@@ -60,23 +132,20 @@ tid_t process_create_initd(const char* file_name)
     char* space = strchr(thread_name, ' ');
     if (space != NULL) *space = '\0';
 
-    struct child_info* info = malloc(sizeof(struct child_info));
+    /* initd를 만드는 main 스레드는 thread_create()를 거치지 않았으므로 여기서 자식 테이블 준비 */
+    if (!process_child_table_init(thread_current())) return TID_ERROR;
+
+    struct child_info* info = child_info_create();
     if (info == NULL)
     {
         return TID_ERROR;
     }
-    info->tid = TID_ERROR;
-    info->exit_status = 0;
-    sema_init(&info->wait_sema, 0);
-
-    list_push_back(&thread_current()->child_info_list, &info->elem);
 
     /* 3. 인자 구조체 생성 (initd에 넘겨주기 위함) */
     struct initd_args* args = malloc(sizeof(struct initd_args));
     if (args == NULL)
     {
         // 실패 시 정리 로직 필요 (생략 가능하지만 안전을 위해)
-        list_remove(&info->elem);
         free(info);
         return TID_ERROR;
     }
@@ -90,11 +159,11 @@ tid_t process_create_initd(const char* file_name)
     if (tid == TID_ERROR)
     {
         free(args);
-        list_remove(&info->elem);
         free(info);
         return TID_ERROR;
     }
     info->tid = tid;
+    hash_insert(&thread_current()->child_table, &info->elem);
     return tid;
 }
 
@@ -128,6 +197,9 @@ tid_t process_fork(const char* name, struct intr_frame* if_ UNUSED)
     /* Clone current thread to new thread.*/
     /* 현재 스레드를 새 스레드로 복제합니다. */
     /* 부모 스레드와 사용자 영역 컨텍스트를 함께 전달하기 위한 구조체 */
+#ifndef VM
+    int64_t start_ticks = timer_ticks();  // fork 지연 시간 측정용
+#endif
     struct fork_data* fork_data = palloc_get_page(0);
 
     if (fork_data == NULL) return TID_ERROR;
@@ -138,19 +210,14 @@ tid_t process_fork(const char* name, struct intr_frame* if_ UNUSED)
     fork_data->success = false;
 
     /* 포크 후 부모 자식간의 연결과 부모 자식간의 상호 작용을 위한 구조체  */
-    struct child_info* info = malloc(sizeof(struct child_info));
+    struct child_info* info = child_info_create();
     if (info == NULL)
     {
         palloc_free_page(fork_data);
         return TID_ERROR;
     }
-    info->tid = TID_ERROR;  // 나중에 업데이트
-    info->exit_status = 0;
-    sema_init(&info->wait_sema, 0);
     // 포그 구조체에 붙여줌
     fork_data->child_info = info;
-    // 부모 한테 붙여줌
-    list_push_back(&thread_current()->child_info_list, &info->elem);
 
     tid_t child_tid = thread_create(name,  // 새 스레드 이름
                                     PRI_DEFAULT, __do_fork,
@@ -158,7 +225,6 @@ tid_t process_fork(const char* name, struct intr_frame* if_ UNUSED)
 
     if (child_tid == TID_ERROR)
     {
-        list_remove(&info->elem);
         free(info);  // 실패하면 해제
         palloc_free_page(fork_data);
         return TID_ERROR;
@@ -173,13 +239,17 @@ tid_t process_fork(const char* name, struct intr_frame* if_ UNUSED)
 
     if (!success)
     {
-        list_remove(&info->elem);
-        free(info);  // 실패하면 해제
+        free(info);  // 실패하면 해제 (자식은 my_info를 끊고 종료함)
         return TID_ERROR;
     }
 
-    // 생성에 성공 했음으로 자식 tid 넣어줌
+    // 생성에 성공 했음으로 자식 tid 넣어주고 부모 한테 붙여줌
     info->tid = child_tid;
+    hash_insert(&thread_current()->child_table, &info->elem);
+#ifndef VM
+    fork_cnt++;
+    fork_ticks += timer_elapsed(start_ticks);
+#endif
 
     /* 자식 프로세스 생성 결과를 돌려준다. */
     return child_tid;
@@ -189,14 +259,16 @@ tid_t process_fork(const char* name, struct intr_frame* if_ UNUSED)
 /* Duplicate the parent's address space by passing this function to the
  * pml4_for_each. This is only for the project 2. */
 /* 이 함수를 pml4_for_each에 전달하여 부모의 주소 공간을 복제합니다. 이것은 프로젝트 2 전용입니다.
- */
+ *
+ * 페이지를 복사하지 않고 부모와 자식이 같은 프레임을 공유합니다 (copy-on-write).
+ * 쓰기 가능한 페이지는 양쪽 모두 읽기 전용 + PTE_COW로 바꿔 두고,
+ * 처음 쓰기 폴트가 날 때 process_handle_cow()에서 복사합니다. */
 static bool duplicate_pte(uint64_t* pte, void* va, void* aux)
 {
     struct thread* current = thread_current();    // 현재 스레드(자식) 가져오기
     struct thread* parent = (struct thread*)aux;  // aux에서 부모 스레드 가져오기
     void* parent_page;                            // 부모의 페이지 주소
-    void* newpage;                                // 새로 할당할 페이지 주소
-    bool writable;                                // 페이지 쓰기 가능 여부
+    bool cow;                                     // COW 공유 대상 여부
 
     /* 1. TODO: If the parent_page is kernel page, then return immediately. */
     /* 1. TODO: parent_page가 커널 페이지이면 즉시 반환합니다. */
@@ -214,41 +286,74 @@ static bool duplicate_pte(uint64_t* pte, void* va, void* aux)
         return false;
     }
 
-    /* 3. TODO: Allocate new PAL_USER page for the child and set result to
-     *    TODO: NEWPAGE. */
-    /* 3. TODO: 자식을 위한 새로운 PAL_USER 페이지를 할당하고 결과를 NEWPAGE에 설정합니다. */
-    newpage = palloc_get_page(PAL_USER);
-    if (newpage == NULL)
+    /* 3. 쓰기 가능한 페이지(또는 이미 COW 중인 페이지)는 부모 쪽 쓰기 권한을 회수합니다.
+     *    TLB는 __do_fork()가 자식 pml4를 활성화할 때 함께 비워집니다. */
+    cow = is_writable(pte) || (*pte & PTE_COW);
+    if (cow)
     {
-        return false;
+        *pte &= ~PTE_W;
+        *pte |= PTE_COW;
     }
 
-    /* 4. TODO: Duplicate parent's page to the new page and
-     *    TODO: check whether parent's page is writable or not (set WRITABLE
-     *    TODO: according to the result). */
-    /* 4. TODO: 부모의 페이지를 새 페이지로 복제하고,
-     *    TODO: 부모의 페이지가 쓰기 가능한지 확인합니다 (결과에 따라 WRITABLE 설정). */
-
-    // 부모 페이지 테이블로 전환
-
-    // 부모의 가상 주소에서 데이터 읽기
-    memcpy(newpage, parent_page, PGSIZE);  // parent_page는 커널 가상 주소
-
-    writable = is_writable(pte);  // PTE_W 플래그 확인
-
-    /* 5. Add new page to child's page table at address VA with WRITABLE
-     *    permission. */
-    /* 5. WRITABLE 권한으로 주소 VA에 자식의 페이지 테이블에 새 페이지를 추가합니다. */
-    if (!pml4_set_page(current->pml4, va, newpage, writable))
+    /* 4. 같은 프레임을 자식 페이지 테이블에 읽기 전용으로 매핑하고 공유 카운트를 올립니다. */
+    if (!pml4_set_page(current->pml4, va, parent_page, false))
     {  // 자식의 페이지 테이블에 페이지 매핑 시도
         /* 6. TODO: if fail to insert page, do error handling. */
         /* 6. TODO: 페이지 삽입에 실패하면 에러 처리를 수행합니다. */
-        palloc_free_page(newpage);
-
         return false;
     }
+    palloc_share_page(parent_page);
+    if (cow)
+    {
+        uint64_t* child_pte = pml4e_walk(current->pml4, (uint64_t)va, 0);
+        *child_pte |= PTE_COW;
+    }
+    cow_shared_cnt++;
     return true;  // 성공 반환
 }
+
+/* COW로 공유 중인 사용자 페이지 ADDR에 대한 쓰기를 처리합니다.
+ * 다른 프로세스와 아직 공유 중이면 새 프레임에 복사하고,
+ * 이미 단독 소유가 되었으면 복사 없이 쓰기 권한만 되돌립니다.
+ * COW 페이지가 아니거나 메모리가 부족하면 false를 반환합니다. */
+bool process_handle_cow(const void* addr)
+{
+    struct thread* t = thread_current();
+    void* upage = pg_round_down(addr);
+
+    if (t->pml4 == NULL || !is_user_vaddr(upage)) return false;
+
+    uint64_t* pte = pml4e_walk(t->pml4, (uint64_t)upage, 0);
+    if (pte == NULL || !(*pte & PTE_P) || !(*pte & PTE_COW)) return false;
+
+    void* kpage = ptov(PTE_ADDR(*pte));
+    if (palloc_page_shared(kpage))
+    {
+        // 아직 다른 프로세스가 쓰는 프레임 -> 복사본을 만들고 공유 참조를 하나 내려놓음
+        void* newpage = alloc_user_page(0);
+        if (newpage == NULL) return false;
+        memcpy(newpage, kpage, PGSIZE);
+        *pte = vtop(newpage) | PTE_P | PTE_W | PTE_U;
+        palloc_free_page(kpage);
+        cow_copied_cnt++;
+    }
+    else
+    {
+        // 나만 남은 프레임 -> 복사 없이 쓰기 권한만 복구
+        *pte = (*pte | PTE_W) & ~PTE_COW;
+        cow_upgraded_cnt++;
+    }
+    invlpg((uint64_t)upage);
+    return true;
+}
+
+/* fork 지연 시간, COW 공유/복사, exec 캐시 통계를 출력합니다. */
+void process_print_stats(void)
+{
+    printf("Fork: %lld forks, %lld ticks, %lld pages shared, %lld copied, %lld upgraded\n",
+           fork_cnt, fork_ticks, cow_shared_cnt, cow_copied_cnt, cow_upgraded_cnt);
+    printf("Exec cache: %lld hits, %lld misses\n", exec_hit_cnt, exec_miss_cnt);
+}
 #endif
 
 /* A thread function that copies parent's execution context.
@@ -286,6 +391,12 @@ static void __do_fork(void* aux)
         // process_activate(current);      // 자식 프로세스의 페이지 테이블 활성화
 
 #ifdef VM
+    /* 지연 로딩되는 세그먼트 페이지는 실행 파일에서 읽으므로 자식도 자기 핸들을 가짐 */
+    if (parent->exec_file != NULL)
+    {
+        current->exec_file = file_duplicate(parent->exec_file);  // 쓰기 금지 상태도 함께 복제됨
+        if (current->exec_file == NULL) goto error;
+    }
     supplemental_page_table_init(&current->spt);  // VM 모드일 때 자식의 보조 페이지 테이블 초기화
     if (!supplemental_page_table_copy(&current->spt,
                                       &parent->spt))  // 부모의 보조 페이지 테이블을 자식으로 복사
@@ -359,6 +470,104 @@ error:
     thread_exit();                      // 스레드 종료
 }
 
+/* CMD_LINE("프로그램 인자 ...")을 실행하는 자식 프로세스를 바로 만듭니다 (fork + exec).
+ * fork와 달리 부모의 주소 공간은 전혀 복제하지 않고 파일 디스크립터만 물려줍니다.
+ * 자식의 load()가 끝날 때까지 기다렸다가, 성공하면 자식 tid를, 실패하면 TID_ERROR를 반환합니다. */
+tid_t process_spawn(const char* cmd_line)
+{
+    /* 부모의 사용자 메모리는 자식이 읽을 수 없으므로 부모의 커널 스택으로 복사.
+     * 부모는 자식의 load()가 끝날 때까지 기다리므로 이 버퍼는 그동안 유효함 */
+    char fn_copy[LOADER_ARGS_LEN];
+    strlcpy(fn_copy, cmd_line, sizeof fn_copy);
+
+    char thread_name[16];
+    strlcpy(thread_name, fn_copy, sizeof thread_name);
+    char* space = strchr(thread_name, ' ');
+    if (space != NULL) *space = '\0';
+
+    struct spawn_data* spawn_data = malloc(sizeof(struct spawn_data));
+    struct child_info* info = child_info_create();
+    if (spawn_data == NULL || info == NULL)
+    {
+        free(spawn_data);
+        free(info);
+        return TID_ERROR;
+    }
+
+    spawn_data->parent = thread_current();
+    spawn_data->fn_copy = fn_copy;
+    sema_init(&spawn_data->child_load, 0);
+    spawn_data->success = false;
+    spawn_data->child_info = info;
+
+    tid_t child_tid = thread_create(thread_name, PRI_DEFAULT, __do_spawn, spawn_data);
+    if (child_tid != TID_ERROR)
+    {
+        // 자식이 load를 마칠 때까지 대기
+        sema_down(&spawn_data->child_load);
+    }
+
+    bool success = child_tid != TID_ERROR && spawn_data->success;
+    free(spawn_data);
+
+    if (!success)
+    {
+        free(info);
+        return TID_ERROR;
+    }
+    info->tid = child_tid;
+    hash_insert(&thread_current()->child_table, &info->elem);
+    return child_tid;
+}
+
+/* process_spawn()으로 만들어진 자식이 실행하는 스레드 함수입니다.
+ * 부모의 fd를 복제한 뒤 바로 새 프로그램을 로드합니다. */
+static void __do_spawn(void* aux)
+{
+    struct spawn_data* spawn_data = (struct spawn_data*)aux;
+    struct thread* parent = spawn_data->parent;
+    struct thread* current = thread_current();
+    struct intr_frame _if;
+
+    current->my_info = spawn_data->child_info;
+#ifdef VM
+    supplemental_page_table_init(&current->spt);
+#endif
+
+    /* 파일 디스크립터 복제 (부모는 load가 끝날 때까지 대기 중이므로 fds가 바뀌지 않음) */
+    for (int i = 0; i < MAX_FD; i++)
+    {
+        struct file* file = parent->fds[i];
+        if (file == NULL || file == (void*)1 || file == (void*)2)
+        {
+            current->fds[i] = file;  // 빈 칸과 표준 입출력 마커는 값만 복사
+            continue;
+        }
+        current->fds[i] = file_duplicate(file);
+        if (current->fds[i] == NULL) goto error;
+    }
+
+    process_init();
+
+    _if.ds = _if.es = _if.ss = SEL_UDSEG;
+    _if.cs = SEL_UCSEG;
+    _if.eflags = FLAG_IF | FLAG_MBS;
+    if (!load(spawn_data->fn_copy, &_if)) goto error;
+
+    /* 부모에게 성공을 알린 뒤에는 spawn_data가 해제될 수 있으므로 더 이상 접근하지 않음 */
+    spawn_data->success = true;
+    sema_up(&spawn_data->child_load);
+    do_iret(&_if);
+    NOT_REACHED();
+
+error:
+    spawn_data->success = false;
+    current->my_info = NULL;
+    current->exit_status = -1;  // 로드 실패는 exit(-1)로 출력
+    sema_up(&spawn_data->child_load);
+    thread_exit();
+}
+
 /* Switch the current execution context to the f_name.
  * Returns -1 on fail. */
 /* 현재 실행 컨텍스트를 f_name으로 전환합니다.
@@ -378,11 +587,11 @@ int process_exec(void* f_name)
     _if.cs = SEL_UCSEG;  // 코드 세그먼트를 사용자 코드 세그먼트로 설정
     _if.eflags = FLAG_IF | FLAG_MBS;  // 인터럽트 플래그와 멀티부트 플래그 설정
 
-    /* file_name을 커널 메모리에 복사 (process_cleanup()에서 페이지 테이블이 파괴되기 전에) */
-    char* fn_copy = palloc_get_page(0);
-    if (fn_copy == NULL) return TID_ERROR;
+    /* file_name을 커널 스택에 복사 (process_cleanup()에서 페이지 테이블이 파괴되기 전에).
+     * load()는 이 버퍼에서 바로 사용자 스택으로 인자를 옮기므로 별도 페이지가 필요 없음 */
     // fn_copy = 'programname args ~'
-    strlcpy(fn_copy, f_name, PGSIZE);
+    char fn_copy[LOADER_ARGS_LEN];
+    strlcpy(fn_copy, f_name, sizeof fn_copy);
 
     /* [추가된 코드] 이전 실행 파일 정리 */
     struct thread* cur = thread_current();
@@ -398,6 +607,9 @@ int process_exec(void* f_name)
     /* We first kill the current context */
     /* 먼저 현재 컨텍스트를 종료합니다 */
     process_cleanup();  // 현재 프로세스의 리소스 정리
+#ifdef VM
+    supplemental_page_table_init(&cur->spt);  // kill로 해제된 보조 페이지 테이블을 새로 준비
+#endif
 
     /* And then load the binary */
     /* 그 다음 바이너리를 로드합니다 */
@@ -405,7 +617,6 @@ int process_exec(void* f_name)
 
     /* If load failed, quit. */
     /* 로드에 실패하면 종료합니다. */
-    palloc_free_page(fn_copy);  // 파일 이름이 저장된 페이지 해제
     if (!success)
     {               // 로드 실패 시
         return -1;  // -1 반환
@@ -442,23 +653,17 @@ int process_wait(tid_t child_tid)
      * XXX:       process_wait를 구현하기 전에 여기에 무한 루프를 추가하는 것을 권장합니다. */
     struct thread* current = thread_current();
     struct child_info* child_info = NULL;  // thread가 아니라 child_info 포인터여야 함
-    struct list_elem* e;
+    struct child_info key;
+    struct hash_elem* e;
 
-    // children 리스트에서 해당 자식 찾기
-    for (e = list_begin(&current->child_info_list); e != list_end(&current->child_info_list);
-         e = list_next(e))
-    {
-        struct child_info* t = list_entry(e, struct child_info, elem);
-        if (t->tid == child_tid)
-        {
-            child_info = t;
-            break;
-        }
-    }
+    // child_table에서 tid로 해당 자식 찾기
+    key.tid = child_tid;
+    e = hash_find(&current->child_table, &key.elem);
 
     // 자식을 찾지 못했거나 자신의 자식이 아니면 -1 반환
-    // (이미 wait된 자식은 children 리스트에서 제거되므로 여기서 -1 반환)
-    if (child_info == NULL) return -1;
+    // (이미 wait된 자식은 child_table에서 제거되므로 여기서 -1 반환)
+    if (e == NULL) return -1;
+    child_info = hash_entry(e, struct child_info, elem);
 
     /*두번쨰 wait 되는거 방지, 인터럽트 꺼야됨?*/
 
@@ -470,12 +675,47 @@ int process_wait(tid_t child_tid)
     int exit_status = child_info->exit_status;
 
     // printf("%d\n", exit_status);
-    list_remove(&child_info->elem);
-    free(child_info);
+    hash_delete(&current->child_table, &child_info->elem);
+    enum intr_level old_level = intr_disable();
+    list_remove(&child_info->exit_elem);  // 종료된 자식 목록에서도 제거
+    intr_set_level(old_level);
+    child_info_release(child_info);
 
     return exit_status;
 }
 
+/* 아무 자식이나 종료될 때까지 대기하고 그 자식의 tid를 반환합니다.
+ * 종료 상태는 *STATUS에 저장합니다 (STATUS가 NULL이 아니면).
+ * 자식이 종료될 때 부모의 exited_children에 직접 넣어주므로 탐색 없이 꺼내기만 합니다.
+ * 기다릴 자식이 없으면 -1을 반환합니다. */
+tid_t process_wait_any(int* status)
+{
+    struct thread* current = thread_current();
+    struct child_info* child_info = NULL;
+
+    for (;;)
+    {
+        enum intr_level old_level = intr_disable();
+        if (!list_empty(&current->exited_children))
+            child_info =
+                list_entry(list_pop_front(&current->exited_children), struct child_info, exit_elem);
+        intr_set_level(old_level);
+        if (child_info != NULL) break;
+
+        if (hash_empty(&current->child_table)) return -1;
+        // wait()로 이미 회수된 자식의 알림이 남아 있을 수 있으므로 깨어나면 다시 확인
+        sema_down(&current->child_exit_sema);
+    }
+
+    sema_down(&child_info->wait_sema);  // 이미 up된 상태이므로 바로 반환됨
+    hash_delete(&current->child_table, &child_info->elem);
+
+    tid_t tid = child_info->tid;
+    if (status != NULL) *status = child_info->exit_status;
+    child_info_release(child_info);
+    return tid;
+}
+
 /* Exit the process. This function is called by thread_exit (). */
 /* 프로세스를 종료합니다. 이 함수는 thread_exit()에 의해 호출됩니다. */
 void process_exit(void)
@@ -538,8 +778,21 @@ void process_exit(void)
     /* 1. 부모에게 내 종료 상태 알림 */
     if (t->my_info != NULL)
     {
-        t->my_info->exit_status = t->exit_status;
-        sema_up(&t->my_info->wait_sema);
+        struct child_info* info = t->my_info;
+        info->exit_status = t->exit_status;
+
+        enum intr_level old_level = intr_disable();
+        if (info->parent != NULL)
+        {
+            // 부모의 종료된 자식 목록에 넣어 waitany가 바로 꺼낼 수 있게 함
+            list_push_back(&info->parent->exited_children, &info->exit_elem);
+            sema_up(&info->parent->child_exit_sema);
+        }
+        sema_up(&info->wait_sema);
+        intr_set_level(old_level);
+
+        t->my_info = NULL;
+        child_info_release(info);
     }
 
     // 종료 상태 출력
@@ -556,12 +809,7 @@ void process_exit(void)
     }
 
     /* 2. 내가 부모로서 가지고 있던 자식 정보들(고아) 메모리 해제 */
-    while (!list_empty(&t->child_info_list))
-    {
-        struct list_elem* e = list_pop_front(&t->child_info_list);
-        struct child_info* child = list_entry(e, struct child_info, elem);
-        free(child);
-    }
+    hash_destroy(&t->child_table, child_info_orphan);
 
     // printf("부모에게 정보를 넘겨줌");
 
@@ -684,61 +932,264 @@ static bool validate_segment(const struct Phdr*, struct file*);  // 세그먼트
 static bool load_segment(struct file* file, off_t ofs, uint8_t* upage,  // 세그먼트 로드 함수
                          uint32_t read_bytes, uint32_t zero_bytes, bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
- * Stores the executable's entry point into *RIP
- * and its initial stack pointer into *RSP.
- * Returns true if successful, false otherwise. */
-/* FILE_NAME에서 ELF 실행 파일을 현재 스레드로 로드합니다.
- * 실행 파일의 진입점을 *RIP에 저장하고
- * 초기 스택 포인터를 *RSP에 저장합니다.
- * 성공하면 true를 반환하고, 그렇지 않으면 false를 반환합니다. */
-static bool load(const char* file_name, struct intr_frame* if_)
+#ifndef VM
+/* exec 캐시.
+ *
+ * 실행 파일의 inode를 키로, 파싱한 PT_LOAD 세그먼트 정보와 로드된 페이지들을 보관합니다.
+ * 같은 바이너리를 다시 exec하면 ELF 헤더를 읽지 않고 캐시된 프레임을 그대로 매핑합니다.
+ * - 읽기 전용 세그먼트: 읽기 전용으로 공유
+ * - 쓰기 가능 세그먼트: PTE_COW로 공유했다가 첫 쓰기 때 복사 (process_handle_cow)
+ * 캐시도 프레임마다 공유 참조를 하나 가지므로, 프로세스가 모두 종료되어도 프레임은 남아 있습니다.
+ * 파일 내용이 바뀌면(inode_write_gen) 해당 항목은 버립니다. */
+#define EXEC_CACHE_MAX 8 /* 캐시할 실행 파일 수 (LRU) */
+#define EXEC_SEG_MAX 8   /* 캐시 가능한 PT_LOAD 세그먼트 수 */
+
+struct exec_segment
 {
-    struct thread* t = thread_current();  // 현재 스레드 가져오기
-    struct ELF ehdr;                      // ELF 헤더 구조체
-    struct file* file = NULL;             // 파일 포인터
-    off_t file_ofs;                       // 파일 오프셋
-    bool success = false;                 // 성공 여부 플래그
-    int i;                                // 반복문 인덱스
+    uint64_t mem_page;    // 세그먼트 시작 가상 주소 (페이지 정렬)
+    size_t page_cnt;      // 세그먼트 페이지 수
+    bool writable;        // 쓰기 가능 세그먼트 여부
+};
+
+struct exec_image
+{
+    struct inode* inode;                         // 키 (캐시가 참조를 하나 유지)
+    unsigned write_gen;                          // 캐시할 때의 inode 쓰기 세대
+    uint64_t entry;                              // ELF 진입점
+    int seg_cnt;                                 // 세그먼트 수
+    struct exec_segment segs[EXEC_SEG_MAX];      // 세그먼트 정보
+    size_t page_cnt;                             // 전체 페이지 수
+    void** pages;                                // 세그먼트 순서대로 나열한 캐시 프레임
+    struct list_elem elem;                       // exec_cache 리스트 연결용 (앞쪽이 최근 사용)
+};
 
-    /* 인자 파싱을 위한 변수들 - 스택 오버플로우 방지를 위해 동적 할당 사용 */
-    char* fn_copy = NULL;
-    char** argv = NULL;
-    uintptr_t* argv_addrs = NULL;
+static struct list exec_cache;
+static size_t exec_cache_cnt;
+static struct lock exec_cache_lock;
 
-    fn_copy = palloc_get_page(0);
-    if (fn_copy == NULL) return false;
+/* exec 캐시를 초기화합니다. 부팅 시 한 번 호출됩니다. */
+void exec_cache_init(void)
+{
+    list_init(&exec_cache);
+    lock_init(&exec_cache_lock);
+}
 
-    argv = palloc_get_page(0);  // 인자 포인터 배열 (동적 할당)
-    if (argv == NULL)
+/* 캐시 항목 IMG를 리스트에서 빼고 해제합니다. exec_cache_lock을 잡은 상태여야 합니다.
+ * 프레임은 캐시의 공유 참조만 내려놓으므로, 아직 매핑한 프로세스가 있으면 살아 있습니다. */
+static void exec_image_free(struct exec_image* img)
+{
+    list_remove(&img->elem);
+    exec_cache_cnt--;
+    for (size_t i = 0; i < img->page_cnt; i++) palloc_free_page(img->pages[i]);
+    free(img->pages);
+    inode_close(img->inode);
+    free(img);
+}
+
+/* 캐시를 모두 비웁니다. 사용자 풀이 부족할 때 호출합니다. */
+static void exec_cache_flush(void)
+{
+    lock_acquire(&exec_cache_lock);
+    while (!list_empty(&exec_cache))
+        exec_image_free(list_entry(list_front(&exec_cache), struct exec_image, elem));
+    lock_release(&exec_cache_lock);
+}
+
+/* 사용자 풀에서 페이지를 할당합니다. 부족하면 exec 캐시를 비우고 한 번 더 시도합니다. */
+static void* alloc_user_page(enum palloc_flags flags)
+{
+    void* kpage = palloc_get_page(PAL_USER | flags);
+    if (kpage == NULL && exec_cache_cnt > 0)
     {
-        palloc_free_page(fn_copy);
+        exec_cache_flush();
+        kpage = palloc_get_page(PAL_USER | flags);
+    }
+    return kpage;
+}
+
+/* 현재 프로세스의 UPAGE에 캐시 프레임 KPAGE를 공유 매핑합니다.
+ * 쓰기 가능 세그먼트이면 COW로 표시합니다. */
+static bool exec_map_shared(void* upage, void* kpage, bool writable)
+{
+    struct thread* t = thread_current();
+
+    if (pml4_get_page(t->pml4, upage) != NULL || !pml4_set_page(t->pml4, upage, kpage, false))
         return false;
+    palloc_share_page(kpage);
+    if (writable)
+    {
+        uint64_t* pte = pml4e_walk(t->pml4, (uint64_t)upage, 0);
+        *pte |= PTE_COW;
     }
+    return true;
+}
+
+/* exec_map_shared()로 매핑한 IMG의 앞쪽 페이지 CNT개를 현재 프로세스에서 지우고
+ * 공유 참조를 내려놓습니다. 매핑이 중간에 실패했을 때, 디스크에서 다시 로드하는
+ * install_page()가 이미 매핑된 주소에서 실패하지 않도록 합니다. */
+static void exec_unmap_shared(struct exec_image* img, size_t cnt)
+{
+    struct thread* t = thread_current();
+    size_t idx = 0;
 
-    argv_addrs = palloc_get_page(0);  // 각 문자열의 실제 주소를 저장할 배열
-    if (argv_addrs == NULL)
+    for (int i = 0; i < img->seg_cnt && idx < cnt; i++)
     {
-        palloc_free_page(argv);
-        palloc_free_page(fn_copy);
-        return false;
+        struct exec_segment* seg = &img->segs[i];
+        for (size_t j = 0; j < seg->page_cnt && idx < cnt; j++)
+        {
+            pml4_clear_page(t->pml4, (void*)(seg->mem_page + j * PGSIZE));
+            palloc_free_page(img->pages[idx++]);
+        }
     }
+}
+
+/* FILE의 캐시된 이미지가 있으면 현재 프로세스에 매핑하고 진입점을 IF_->rip에 설정합니다.
+ * 캐시에 없거나 내용이 바뀌었거나 매핑에 실패하면 false를 반환합니다. */
+static bool exec_cache_map(struct file* file, struct intr_frame* if_)
+{
+    struct inode* inode = file_get_inode(file);
+    bool success = false;
+    struct list_elem* e;
+
+    lock_acquire(&exec_cache_lock);
+    for (e = list_begin(&exec_cache); e != list_end(&exec_cache); e = list_next(e))
+    {
+        struct exec_image* img = list_entry(e, struct exec_image, elem);
+        if (img->inode != inode) continue;
+
+        if (img->write_gen != inode_write_gen(inode))
+        {
+            // 캐시 이후 파일이 수정됨 -> 버리고 디스크에서 다시 로드
+            exec_image_free(img);
+            break;
+        }
+
+        size_t mapped = 0;
+        success = true;
+        for (int i = 0; i < img->seg_cnt && success; i++)
+        {
+            struct exec_segment* seg = &img->segs[i];
+            for (size_t j = 0; j < seg->page_cnt && success; j++)
+            {
+                success = exec_map_shared((void*)(seg->mem_page + j * PGSIZE), img->pages[mapped],
+                                          seg->writable);
+                if (success) mapped++;
+            }
+        }
+        if (success)
+        {
+            if_->rip = img->entry;
+            list_remove(&img->elem);
+            list_push_front(&exec_cache, &img->elem);
+            exec_hit_cnt++;
+        }
+        else
+            exec_unmap_shared(img, mapped);  // 매핑한 만큼 되돌려야 디스크 로드가 가능
+        break;
+    }
+    lock_release(&exec_cache_lock);
+    return success;
+}
+
+/* 방금 디스크에서 로드한 FILE의 세그먼트 SEGS를 캐시에 등록합니다.
+ * 현재 프로세스의 프레임을 그대로 캐시 프레임으로 쓰고, 쓰기 가능 세그먼트는 COW로 바꿉니다.
+ * WRITE_GEN은 ELF를 읽기 전에 얻은 inode 쓰기 세대입니다. */
+static void exec_cache_insert(struct file* file, unsigned write_gen, uint64_t entry,
+                              const struct exec_segment* segs, int seg_cnt)
+{
+    struct thread* t = thread_current();
+    struct inode* inode = file_get_inode(file);
+    struct exec_image* img;
+    struct list_elem* e;
+    size_t page_cnt = 0;
 
-    int argc = 0;  // 인자 개수
-    char *token, *save_ptr;
+    for (int i = 0; i < seg_cnt; i++) page_cnt += segs[i].page_cnt;
 
-    /* file_name을 복사 (strtok_r이 원본을 수정하므로) */
-    strlcpy(fn_copy, file_name, LOADER_ARGS_LEN);
+    img = malloc(sizeof *img);
+    if (img == NULL) return;
+    img->pages = malloc(page_cnt * sizeof *img->pages);
+    if (img->pages == NULL)
+    {
+        free(img);
+        return;
+    }
 
-    /* 공백으로 인자 파싱 */
-    for (token = strtok_r(fn_copy, " ", &save_ptr); token != NULL;
-         token = strtok_r(NULL, " ", &save_ptr))
+    lock_acquire(&exec_cache_lock);
+    for (e = list_begin(&exec_cache); e != list_end(&exec_cache); e = list_next(e))
     {
-        argv[argc++] = token;
+        if (list_entry(e, struct exec_image, elem)->inode == inode)
+        {
+            // 다른 프로세스가 먼저 등록함
+            lock_release(&exec_cache_lock);
+            free(img->pages);
+            free(img);
+            return;
+        }
     }
+    if (exec_cache_cnt >= EXEC_CACHE_MAX)
+        exec_image_free(list_entry(list_back(&exec_cache), struct exec_image, elem));
+
+    img->inode = inode_reopen(inode);
+    img->write_gen = write_gen;
+    img->entry = entry;
+    img->seg_cnt = seg_cnt;
+    memcpy(img->segs, segs, seg_cnt * sizeof *segs);
+    img->page_cnt = page_cnt;
+
+    size_t idx = 0;
+    for (int i = 0; i < seg_cnt; i++)
+    {
+        for (size_t j = 0; j < segs[i].page_cnt; j++)
+        {
+            void* upage = (void*)(segs[i].mem_page + j * PGSIZE);
+            uint64_t* pte = pml4e_walk(t->pml4, (uint64_t)upage, 0);
+
+            img->pages[idx++] = ptov(PTE_ADDR(*pte));
+            palloc_share_page(ptov(PTE_ADDR(*pte)));  // 캐시의 참조
+            if (segs[i].writable)
+            {
+                *pte = (*pte & ~PTE_W) | PTE_COW;
+                invlpg((uint64_t)upage);
+            }
+        }
+    }
+    list_push_front(&exec_cache, &img->elem);
+    exec_cache_cnt++;
+    lock_release(&exec_cache_lock);
+}
+#endif
+
+/* Loads an ELF executable from FILE_NAME into the current thread.
+ * Stores the executable's entry point into *RIP
+ * and its initial stack pointer into *RSP.
+ * Returns true if successful, false otherwise. */
+/* CMD_LINE("프로그램 인자 ...")의 ELF 실행 파일을 현재 스레드로 로드합니다.
+ * 실행 파일의 진입점을 *RIP에 저장하고
+ * 초기 스택 포인터를 *RSP에 저장합니다.
+ * 성공하면 true를 반환하고, 그렇지 않으면 false를 반환합니다.
+ *
+ * CMD_LINE은 호출자의 커널 버퍼(최대 LOADER_ARGS_LEN)이며, 프로그램 이름을 여는 동안만
+ * 잠시 수정했다가 되돌립니다. 인자는 사용자 스택 위에서 바로 잘라 배치합니다. */
+static bool load(char* cmd_line, struct intr_frame* if_)
+{
+    struct thread* t = thread_current();  // 현재 스레드 가져오기
+    struct ELF ehdr;                      // ELF 헤더 구조체
+    struct file* file = NULL;             // 파일 포인터
+    off_t file_ofs;                       // 파일 오프셋
+    bool success = false;                 // 성공 여부 플래그
+    int i;                                // 반복문 인덱스
+#ifndef VM
+    struct exec_segment segs[EXEC_SEG_MAX];  // exec 캐시에 등록할 세그먼트들
+    int seg_cnt = 0;                         // 세그먼트 수 (-1이면 캐시하지 않음)
+    unsigned write_gen = 0;                  // ELF를 읽기 전의 inode 쓰기 세대
+#endif
 
+    /* 프로그램 이름(첫 번째 토큰) 찾기 */
+    char* file_name = cmd_line;
+    while (*file_name == ' ') file_name++;
     /* 최소한 실행 파일 이름은 있어야 함 */
-    if (argc == 0) goto done;
+    if (*file_name == '\0') return false;
+    char* name_end = strchr(file_name, ' ');
 
     /* Allocate and activate page directory. */
     /* 페이지 디렉토리를 할당하고 활성화합니다. */
@@ -749,17 +1200,24 @@ static bool load(const char* file_name, struct intr_frame* if_)
     process_activate(thread_current());  // 현재 스레드의 페이지 테이블 활성화
 
     /* Open executable file. */
-    /* 실행 파일을 엽니다. */
-    file = filesys_open(argv[0]);  // 파일 시스템에서 파일 열기
-    if (file == NULL)
-    {                                                // 파일 열기 실패 시
-        printf("load: %s: open failed\n", argv[0]);  // 에러 메시지 출력
-        goto done;                                   // 종료 처리로 이동
-    }
+    /* 실행 파일을 엽니다. (이름 뒤를 잠시 '\0'으로 끊었다가 복구) */
+    if (name_end != NULL) *name_end = '\0';
+    file = filesys_open(file_name);  // 파일 시스템에서 파일 열기
+    if (file == NULL) printf("load: %s: open failed\n", file_name);  // 에러 메시지 출력
+    if (name_end != NULL) *name_end = ' ';
+    if (file == NULL)  // 파일 열기 실패 시
+        goto done;     // 종료 처리로 이동
 
     file_deny_write(file);  // 현재 연 파일에 대헤 수정 금지
     t->exec_file = file;
 
+#ifndef VM
+    /* 같은 실행 파일이 캐시되어 있으면 헤더 파싱과 세그먼트 읽기를 모두 건너뜀 */
+    if (exec_cache_map(file, if_)) goto setup;
+    exec_miss_cnt++;
+    write_gen = inode_write_gen(file_get_inode(file));
+#endif
+
     /* Read and verify executable header. */
     /* 실행 파일 헤더를 읽고 검증합니다. */
     if (file_read(file, &ehdr, sizeof ehdr) != sizeof ehdr  // ELF 헤더 읽기 실패
@@ -770,7 +1228,7 @@ static bool load(const char* file_name, struct intr_frame* if_)
         || ehdr.e_phentsize != sizeof(struct Phdr)  // 프로그램 헤더 크기 불일치
         || ehdr.e_phnum > 1024)
     {  // 프로그램 헤더 개수가 너무 많음
-        printf("load: %s: error loading executable\n", file_name);  // 에러 메시지 출력
+        printf("load: %s: error loading executable\n", cmd_line);  // 에러 메시지 출력
         goto done;                                                  // 종료 처리로 이동
     }
 
@@ -836,6 +1294,17 @@ static bool load(const char* file_name, struct intr_frame* if_)
                     if (!load_segment(file, file_page, (void*)mem_page,  // 세그먼트 로드 시도
                                       read_bytes, zero_bytes, writable))
                         goto done;  // 로드 실패 시 종료 처리로 이동
+#ifndef VM
+                    if (seg_cnt >= 0 && seg_cnt < EXEC_SEG_MAX)
+                    {
+                        segs[seg_cnt].mem_page = mem_page;
+                        segs[seg_cnt].page_cnt = (read_bytes + zero_bytes) / PGSIZE;
+                        segs[seg_cnt].writable = writable;
+                        seg_cnt++;
+                    }
+                    else
+                        seg_cnt = -1;  // 세그먼트가 너무 많으면 캐시하지 않음
+#endif
                 }
                 else            // 세그먼트 유효성 검사 실패
                     goto done;  // 종료 처리로 이동
@@ -843,26 +1312,32 @@ static bool load(const char* file_name, struct intr_frame* if_)
         }
     }
 
+    /* Start address. */
+    /* 시작 주소. */
+    if_->rip = ehdr.e_entry;  // 인터럽트 프레임의 RIP에 ELF 진입점 주소 설정
+
+#ifndef VM
+    if (seg_cnt > 0) exec_cache_insert(file, write_gen, ehdr.e_entry, segs, seg_cnt);
+
+setup:
+#endif
     /* Set up stack. */
     /* 스택을 설정합니다. */
     if (!setup_stack(if_))  // 스택 설정 실패 시
         goto done;          // 종료 처리로 이동
 
-    /* Start address. */
-    /* 시작 주소. */
-    if_->rip = ehdr.e_entry;  // 인터럽트 프레임의 RIP에 ELF 진입점 주소 설정
-
     /* ========== 인자를 스택에 배치 ========== */
     /*
+     * 명령줄 전체를 스택 맨 위에 한 번에 복사한 뒤, 그 자리에서 공백을 '\0'으로 바꿔
+     * 토큰을 나누고 바로 아래에 argv 포인터 배열을 채웁니다. (임시 페이지 없음)
+     *
      * 최종 스택 레이아웃 (주소가 낮아지는 방향):
      *
      * USER_STACK (0x47480000)
      *    |
      *    v (스택 아래로 자람)
      * +----------------------+
-     * | "args-single\0"      | ← argv[0]이 가리키는 문자열
-     * +----------------------+
-     * | "onearg\0"           | ← argv[1]이 가리키는 문자열
+     * | "args-single\0onearg\0" | ← 명령줄 (공백 → '\0'), argv[0]이 가장 낮은 주소
      * +----------------------+
      * | padding (8바이트 정렬)| ← 0~7바이트 패딩
      * +----------------------+
@@ -878,104 +1353,53 @@ static bool load(const char* file_name, struct intr_frame* if_)
      * 레지스터:
      * RDI = 2 (argc)
      * RSI = argv 배열의 주소 (argv[0]의 주소)
+     *
+     * 전체 크기가 LOADER_ARGS_LEN 정도이므로 모두 setup_stack()이 만든 첫 스택 페이지 안에 들어감
      */
+    size_t len = strnlen(file_name, LOADER_ARGS_LEN - 1);  // 앞쪽 공백은 제외
+    uintptr_t str_base = USER_STACK - (len + 1);            // 명령줄이 놓일 사용자 주소
+    uint8_t* kstack = pml4_get_page(t->pml4, (void*)(USER_STACK - PGSIZE));  // 스택 페이지
+    if (kstack == NULL) goto done;
+    char* kstr = (char*)kstack + (str_base - (USER_STACK - PGSIZE));  // 같은 위치의 커널 주소
+    memcpy(kstr, file_name, len);
+    kstr[len] = '\0';
+
+    // 1. 제자리에서 공백을 '\0'으로 바꾸며 인자 개수 세기
+    int argc = 0;
+    for (i = 0; i < (int)len; i++)
+    {
+        if (kstr[i] == ' ')
+            kstr[i] = '\0';
+        else if (i == 0 || kstr[i - 1] == '\0')
+            argc++;  // 새 토큰의 시작
+    }
 
-    // 스택 포인터 (현재 USER_STACK을 가리킴)
-    uintptr_t rsp = if_->rsp;
+    // 2. 8바이트 정렬 후 argv[0..argc] 자리 확보 (+ fake return address)
+    uintptr_t argv_addr = (str_base & ~0x7) - (argc + 1) * sizeof(char*);
+    uintptr_t rsp = argv_addr - sizeof(void*);
+    uintptr_t* kargv = (uintptr_t*)(kstack + (argv_addr - (USER_STACK - PGSIZE)));
 
-    // 1. 각 인자 문자열을 스택에 배치 (역순으로)
-    // 왜 역순? argv[0]이 낮은 주소에 있어야 하므로, 나중에 push한 것이 먼저 나옴
-    // argv_addrs는 이미 동적 할당됨
+    // 3. 토큰을 다시 훑으며 argv 포인터를 채움, argv[argc] = NULL
+    int n = 0;
+    for (i = 0; i < (int)len; i++)
+        if (kstr[i] != '\0' && (i == 0 || kstr[i - 1] == '\0')) kargv[n++] = str_base + i;
+    kargv[argc] = 0;
 
-    for (i = argc - 1; i >= 0; i--)  // argc-1부터 0까지 역순
-    {
-        size_t len = strlen(argv[i]) + 1;  // 문자열 길이 + null terminator
-        rsp -= len;                        // 스택 포인터를 문자열 크기만큼 내림
-
-        // 사용자 가상 주소에 쓰기 위해 커널 가상 주소를 가져옴
-        void* kpage = pml4_get_page(t->pml4, (void*)rsp);
-        if (kpage == NULL) goto done;  // 페이지가 없으면 오류
-        memcpy(kpage, argv[i], len);  // 커널 가상 주소를 통해 문자열을 스택에 복사
-        argv_addrs[i] = rsp;          // 이 문자열의 주소를 저장
-    }
-    // 예: argc=2, argv[0]="args-single", argv[1]="onearg"
-    //     먼저 argv[1] "onearg\0"를 스택에 push
-    //     그 다음 argv[0] "args-single\0"를 스택에 push
-
-    // 2. 8바이트 정렬 (word-align)
-    // x86-64 ABI 요구사항: 스택은 8바이트 경계에 정렬되어야 함
-    // 예: rsp가 0x47479ff3이면 → 0x47479ff0으로 내림 (하위 3비트를 0으로)
-    rsp = rsp & ~0x7;  // 비트 AND 연산으로 8의 배수로 내림
-    // ~0x7 = 0xFFFFFFFFFFFFFFF8 (마지막 3비트가 0)
-
-    // 3. argv[argc] = NULL 배치
-    // C 표준: argv 배열은 NULL 포인터로 끝나야 함
-    rsp -= sizeof(char*);  // 포인터 크기(8바이트)만큼 스택 내림
-    void* kpage = pml4_get_page(t->pml4, (void*)rsp);
-    if (kpage == NULL) goto done;
-    *(char**)kpage = NULL;  // NULL 포인터 저장
-
-    // 4. argv 배열 (포인터들) 배치 (역순으로)
-    // argv[argc-1], argv[argc-2], ..., argv[0] 순서로 push
-    for (i = argc - 1; i >= 0; i--)
-    {
-        rsp -= sizeof(char*);  // 포인터 크기만큼 스택 내림
-        kpage = pml4_get_page(t->pml4, (void*)rsp);
-        if (kpage == NULL) goto done;
-        *(uintptr_t*)kpage = argv_addrs[i];  // 문자열 주소를 스택에 저장
-    }
-    // 예: 먼저 argv[1]의 주소를 push, 그 다음 argv[0]의 주소를 push
-    // 결과: 스택에서 위에서 아래로 argv[0], argv[1], ... 순서로 배치됨
-
-    // 5. argv 배열의 시작 주소 저장
-    // RSI 레지스터에 전달할 값 (argv[0]의 주소를 가리키는 포인터)
-    uintptr_t argv_addr = rsp;
-
-    // 6. fake return address 배치
-    // 함수 호출 규약: 스택에는 리턴 주소가 있어야 함
-    // main()은 실제로 return하지 않지만, 구조상 필요
-    rsp -= sizeof(void*);  // 포인터 크기만큼 스택 내림
-    kpage = pml4_get_page(t->pml4, (void*)rsp);
-    if (kpage == NULL) goto done;
-    *(void**)kpage = NULL;  // NULL을 리턴 주소로 (실제로는 사용 안 됨)
-
-    // 7. 레지스터 설정
-    // x86-64 호출 규약: 첫 6개 인자는 레지스터로 전달
-    // 1번째 인자 → RDI, 2번째 인자 → RSI, 3번째 → RDX, ...
+    // 4. fake return address
+    // 함수 호출 규약: 스택에는 리턴 주소가 있어야 함 (main()은 실제로 return하지 않음)
+    *(uintptr_t*)(kstack + (rsp - (USER_STACK - PGSIZE))) = 0;
+
+    // 5. 레지스터 설정
+    // x86-64 호출 규약: 1번째 인자 → RDI, 2번째 인자 → RSI
     if_->R.rdi = argc;       // 첫 번째 인자: argc (인자 개수)
     if_->R.rsi = argv_addr;  // 두 번째 인자: argv (인자 배열의 주소)
     if_->rsp = rsp;          // 스택 포인터를 최종 위치로 업데이트
 
-    /*
-     * 최종 결과:
-     * - 사용자 프로그램의 main(argc, argv)가 호출될 때
-     * - RDI = 2 (argc)
-     * - RSI = argv 배열 주소 (argv[0], argv[1], NULL을 가리키는 포인터 배열)
-     * - RSP = 스택의 최하단 (fake return address)
-     *
-     * 사용자 프로그램은 다음과 같이 인자를 받음:
-     * int main(int argc, char *argv[])
-     * {
-     *     // argc = 2
-     *     // argv[0] = "args-single"
-     *     // argv[1] = "onearg"
-     *     // argv[2] = NULL
-     * }
-     */
-
     success = true;  // 성공 플래그 설정
-    // 성공한 경우 할당한 메모리 해제
-    palloc_free_page(argv_addrs);
-    palloc_free_page(argv);
-    palloc_free_page(fn_copy);
 done:
     /* We arrive here whether the load is successful or not. */
     if (!success)
     {
-        // 실패 시 할당한 메모리 해제
-        if (argv_addrs != NULL) palloc_free_page(argv_addrs);
-        if (argv != NULL) palloc_free_page(argv);
-        if (fn_copy != NULL) palloc_free_page(fn_copy);
         if (file != NULL)
         {
             file_close(file);  // ← 실패한 경우에만 닫음!
@@ -1103,8 +1527,8 @@ static bool load_segment(struct file* file, off_t ofs, uint8_t* upage, uint32_t
 
         /* Get a page of memory. */
         /* 메모리 페이지를 가져옵니다. */
-        uint8_t* kpage = palloc_get_page(PAL_USER);  // 사용자 풀에서 페이지 할당
-        if (kpage == NULL)                           // 할당 실패 시
+        uint8_t* kpage = alloc_user_page(0);  // 사용자 풀에서 페이지 할당
+        if (kpage == NULL)                    // 할당 실패 시
             return false;                            // 실패 반환
 
         /* Load this page. */
@@ -1141,7 +1565,7 @@ static bool setup_stack(struct intr_frame* if_)
     uint8_t* kpage;        // 커널 페이지 포인터
     bool success = false;  // 성공 여부 플래그
 
-    kpage = palloc_get_page(PAL_USER | PAL_ZERO);  // 0으로 초기화된 사용자 페이지 할당
+    kpage = alloc_user_page(PAL_ZERO);  // 0으로 초기화된 사용자 페이지 할당
     if (kpage != NULL)
     {  // 페이지 할당 성공 시
         success = install_page(((uint8_t*)USER_STACK) - PGSIZE, kpage,
@@ -1188,14 +1612,23 @@ static bool install_page(void* upage, void* kpage, bool writable)
 /* 여기서부터는 프로젝트 3 이후에 사용될 코드입니다.
  * 프로젝트 2만을 위한 함수를 구현하려면 위 블록에 구현하세요. */
 
-static bool lazy_load_segment(struct page* page, void* aux)
+/* 세그먼트 페이지를 첫 폴트 시점에 실행 파일에서 읽어 옵니다.
+ * 읽을 위치는 페이지별 aux 대신 세그먼트 영역(REGION_SEGMENT)에서 계산하므로
+ * fork 시 aux를 복제할 필요 없이 페이지를 그대로 물려줄 수 있습니다. */
+static bool lazy_load_segment(struct page* page, void* aux UNUSED)
 {
-    /* TODO: Load the segment from the file */
-    /* TODO: 파일에서 세그먼트를 로드합니다 */
-    /* TODO: This called when the first page fault occurs on address VA. */
-    /* TODO: 이것은 주소 VA에서 첫 번째 페이지 폴트가 발생할 때 호출됩니다. */
-    /* TODO: VA is available when calling this function. */
-    /* TODO: 이 함수를 호출할 때 VA를 사용할 수 있습니다. */
+    struct thread* owner = page->owner;
+    struct spt_region* region = spt_region_find(&owner->spt, page->va);
+    off_t page_start = (uint8_t*)page->va - (uint8_t*)region->start;
+    off_t read_bytes = region->file_bytes - page_start;
+
+    if (read_bytes <= 0) return true;  // 전부 bss (anon_initializer가 이미 0으로 채움)
+    if (read_bytes > PGSIZE) read_bytes = PGSIZE;
+
+    /* file_read_at은 파일 위치를 건드리지 않고, 시스템 콜이 filesys_lock을 잡은 채
+     * 폴트할 수 있으므로 여기서는 락을 잡지 않습니다. */
+    return file_read_at(owner->exec_file, page->frame->kva, read_bytes,
+                        region->ofs + page_start) == read_bytes;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -1231,6 +1664,13 @@ static bool load_segment(struct file* file, off_t ofs, uint8_t* upage, uint32_t
     ASSERT(pg_ofs(upage) == 0);  // 가상 주소가 페이지 정렬되어 있는지 확인
     ASSERT(ofs % PGSIZE == 0);   // 파일 오프셋이 페이지 크기의 배수인지 확인
 
+    /* 세그먼트 전체를 영역으로 등록: 페이지별 로드 위치 계산과 폴트 주변 읽기에 사용 */
+    struct spt_region* region = spt_region_insert(
+        &thread_current()->spt, upage, upage + read_bytes + zero_bytes, REGION_SEGMENT, NULL);
+    if (region == NULL) return false;
+    region->ofs = ofs;
+    region->file_bytes = read_bytes;
+
     while (read_bytes > 0 || zero_bytes > 0)
     {  // 읽을 바이트나 0으로 채울 바이트가 남아있는 동안 반복
         /* Do calculate how to fill this page.
@@ -1244,12 +1684,10 @@ static bool load_segment(struct file* file, off_t ofs, uint8_t* upage, uint32_t
                                      : PGSIZE;  // 이 페이지에서 읽을 바이트 수 (최대 PGSIZE)
         size_t page_zero_bytes = PGSIZE - page_read_bytes;  // 이 페이지에서 0으로 채울 바이트 수
 
-        /* TODO: Set up aux to pass information to the lazy_load_segment. */
-        /* TODO: lazy_load_segment에 정보를 전달하기 위해 aux를 설정합니다. */
-        void* aux = NULL;  // 보조 데이터 포인터 (초기화 필요)
+        /* 전부 0인 페이지(bss)는 읽을 것이 없으므로 초기화 함수 없이 빈 익명 페이지로 둠 */
         if (!vm_alloc_page_with_initializer(
                 VM_ANON, upage,  // 익명 페이지를 lazy_load_segment로 초기화하여 할당
-                writable, lazy_load_segment, aux))
+                writable, page_read_bytes > 0 ? lazy_load_segment : NULL, NULL))
             return false;  // 할당 실패 시 false 반환
 
         /* Advance. */
@@ -1268,14 +1706,14 @@ static bool setup_stack(struct intr_frame* if_)
     bool success = false;                                           // 성공 여부 플래그
     void* stack_bottom = (void*)(((uint8_t*)USER_STACK) - PGSIZE);  // 스택 하단 주소 계산
 
-    /* TODO: Map the stack on stack_bottom and claim the page immediately.
-     * TODO: If success, set the rsp accordingly.
-     * TODO: You should mark the page is stack. */
-    /* TODO: stack_bottom에 스택을 매핑하고 페이지를 즉시 클레임합니다.
-     * TODO: 성공하면 rsp를 그에 따라 설정합니다.
-     * TODO: 페이지가 스택임을 표시해야 합니다. */
-    /* TODO: Your code goes here */
-    /* TODO: 여기에 코드를 작성하세요 */
+    /* 첫 스택 페이지는 인자를 바로 써 넣어야 하므로 지연시키지 않고 즉시 클레임 */
+    if (vm_alloc_page(VM_ANON | VM_STACK, stack_bottom, true) && vm_claim_page(stack_bottom) &&
+        spt_region_insert(&thread_current()->spt, stack_bottom, (void*)USER_STACK, REGION_STACK,
+                          NULL))
+    {
+        if_->rsp = USER_STACK;
+        success = true;
+    }
 
     return success;  // 성공 여부 반환
 }
@@ -55,6 +55,14 @@ static void sys_seek(struct intr_frame *f);
 static void sys_tell(struct intr_frame *f);
 static void sys_close(struct intr_frame *f);
 static void sys_dup2(struct intr_frame *f);
+static void sys_spawn(struct intr_frame *f);
+static void sys_waitany(struct intr_frame *f);
+#ifdef VM
+static void sys_mmap(struct intr_frame *f);
+static void sys_munmap(struct intr_frame *f);
+static void sys_memstat(struct intr_frame *f);
+static void sys_set_rss_limit(struct intr_frame *f);
+#endif
 
 void syscall_init(void)
 {
@@ -76,6 +84,9 @@ void syscall_handler(struct intr_frame *f UNUSED)
         PANIC("syscall_handler: null frame");
     }
 
+#ifdef VM
+    thread_current()->user_rsp = f->rsp;  // 커널 모드 폴트에서 스택 성장 여부를 판단할 때 사용
+#endif
     switch (f->R.rax)
     {
         case SYS_HALT:
@@ -123,6 +134,26 @@ void syscall_handler(struct intr_frame *f UNUSED)
         case SYS_DUP2:
             sys_dup2(f);
             break;
+        case SYS_SPAWN:
+            sys_spawn(f);
+            break;
+        case SYS_WAITANY:
+            sys_waitany(f);
+            break;
+#ifdef VM
+        case SYS_MMAP:
+            sys_mmap(f);
+            break;
+        case SYS_MUNMAP:
+            sys_munmap(f);
+            break;
+        case SYS_MEMSTAT:
+            sys_memstat(f);
+            break;
+        case SYS_SET_RSS_LIMIT:
+            sys_set_rss_limit(f);
+            break;
+#endif
         default:
             printf("unhandled system call: %lld\n", (long long)f->R.rax);
             thread_exit();
@@ -155,6 +186,14 @@ static bool check_user_vaddr(const void *uaddr, bool writable)
     {
         return false;
     }
+#ifdef VM
+    // VM에서는 아직 올라오지 않은(지연 로딩/스왑된) 페이지도 유효하므로 보조 페이지 테이블로 판단.
+    // 실제 접근 시의 폴트는 vm_try_handle_fault()가 처리함
+    // 쓰기가 필요하면 COW로 공유 중인 페이지를 여기서 미리 복사해 둠 (CR0.WP가 꺼져 있음)
+    // 스택 아래쪽의 버퍼라면 여기서 스택을 늘려 둠
+    struct page *page = vm_lookup_page((void *)uaddr);
+    return page != NULL && (!writable || (page->writable && vm_prepare_write(page)));
+#else
     // 2단계: 페이지 테이블 엔트리 가져오기 (매핑 여부 확인)
     uint64_t *pte = pml4e_walk(thread_current()->pml4, (uint64_t)uaddr, 0);
     // 사용 가능한 페이지인지 확인
@@ -166,9 +205,13 @@ static bool check_user_vaddr(const void *uaddr, bool writable)
     // writable == false면 이 검사는 건너뜀 (읽기만 가능해도 OK)
     if (writable && !(*pte & PTE_W))
     {
+        // CR0.WP가 꺼져 있어 커널의 쓰기는 폴트가 나지 않으므로,
+        // COW 공유 페이지라면 여기서 미리 복사해 둠
+        if (process_handle_cow(uaddr)) return true;
         return false;  // 쓰기 불가능한 페이지 (읽기 전용)
     }
     return true;  // 모든 검증 통과
+#endif
 }
 
 /* 버퍼 전체 영역의 유효성을 검증하는 함수
@@ -285,6 +328,27 @@ static void sys_exec(struct intr_frame *f UNUSED)
     }
 }
 
+static void sys_spawn(struct intr_frame *f)
+{
+    // 첫 번째 인자 실행할 명령줄 ("프로그램 인자 ...")
+    const char *cmd_line = (const char *)f->R.rdi;
+    // 문자열 유효성 검증
+    check_valid_string(cmd_line);
+    // fork와 달리 주소 공간을 복제하지 않고 바로 새 프로그램을 로드
+    f->R.rax = process_spawn(cmd_line);
+}
+
+static void sys_waitany(struct intr_frame *f)
+{
+    // 첫 번째 인자 종료 상태를 받을 주소 (NULL 허용)
+    int *status = (int *)f->R.rdi;
+    int exit_status;
+    if (status != NULL) check_valid_buffer(status, sizeof *status, true);
+    f->R.rax = process_wait_any(&exit_status);
+    // 자식을 회수했을 때만 종료 상태를 돌려줌
+    if (status != NULL && (int)f->R.rax != -1) *status = exit_status;
+}
+
 static void sys_wait(struct intr_frame *f UNUSED)
 {
     // 첫 번째 인자 wait 할 프로그램 pid
@@ -586,4 +650,57 @@ static void sys_dup2(struct intr_frame *f UNUSED)
     t->fds[new_fd] = t->fds[old_fd];
     // 성공 했으니 복사된거 반환
     f->R.rax = new_fd;
-}
\ No newline at end of file
+}
+#ifdef VM
+static void sys_mmap(struct intr_frame *f)
+{
+    void *addr = (void *)f->R.rdi;  // 첫 번째 인자: 매핑할 주소
+    size_t length = f->R.rsi;       // 두 번째 인자: 길이
+    int writable = f->R.rdx;        // 세 번째 인자: 쓰기 가능 여부
+    int fd = f->R.r10;              // 네 번째 인자: 파일 디스크립터
+    off_t offset = f->R.r8;         // 다섯 번째 인자: 파일 오프셋
+    struct thread *t = thread_current();
+
+    // 표준 입출력이나 열리지 않은 fd는 매핑할 수 없음
+    if (fd < 0 || fd >= MAX_FD || t->fds[fd] == NULL || t->fds[fd] == STDIN_VAL ||
+        t->fds[fd] == STDOUT_VAL)
+    {
+        f->R.rax = (uint64_t)NULL;
+        return;
+    }
+    lock_acquire(&filesys_lock);
+    f->R.rax = (uint64_t)do_mmap(addr, length, writable, t->fds[fd], offset);
+    lock_release(&filesys_lock);
+}
+
+static void sys_munmap(struct intr_frame *f)
+{
+    // 첫 번째 인자: mmap()이 돌려준 주소. 더티 페이지만 파일에 다시 씀
+    lock_acquire(&filesys_lock);
+    do_munmap((void *)f->R.rdi);
+    lock_release(&filesys_lock);
+}
+
+static void sys_memstat(struct intr_frame *f)
+{
+    tid_t pid = f->R.rdi;                          // 첫 번째 인자: 조회할 프로세스 pid
+    struct vm_memstat *stat = (void *)f->R.rsi;    // 두 번째 인자: 결과를 받을 사용자 버퍼
+    struct vm_memstat result;
+
+    check_valid_buffer(stat, sizeof *stat, true);
+    // 살아 있는 프로세스가 아니면 -1
+    if (!vm_memstat(pid, &result))
+    {
+        f->R.rax = -1;
+        return;
+    }
+    *stat = result;
+    f->R.rax = 0;
+}
+
+static void sys_set_rss_limit(struct intr_frame *f)
+{
+    // 첫 번째 인자: 새 상주 페이지 소프트 한도 (0이면 기본값). 이전 한도를 반환
+    f->R.rax = vm_set_rss_limit(f->R.rdi);
+}
+#endif
@@ -1,7 +1,14 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include <bitmap.h>
+#include <lz.h>
+#include <stdio.h>
+#include <string.h>
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,11 +24,74 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* Sectors per swap slot: one slot holds one page. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Neighbouring slots read along with a faulting page. */
+#define SWAP_READAHEAD 4
+
+/* Swap slot allocator.  SWAP_MAP has one bit per slot; SLOT_PAGES
+ * maps an in-use slot back to the page stored there, so swap-in can
+ * find neighbours that belong to the same process.  A slot inherited
+ * across fork is shared by several pages; SLOT_REFS counts them, and
+ * SLOT_PAGES then names at most one of them.  SWAP_LOCK protects all
+ * three, the zswap tier below, and each process's count of swapped
+ * pages. */
+static struct bitmap *swap_map;
+static struct page **slot_pages;
+static unsigned *slot_refs;
+static struct lock swap_lock;
+
+/* Compressed swap tier.  Evicted pages that compress well are kept in
+ * kernel memory instead of going to disk, up to ZSWAP_BUDGET bytes in
+ * all.  An entry must fit in one of malloc()'s arena blocks, so a page
+ * that compresses to more than ZSWAP_ENTRY_MAX bytes is written to the
+ * swap disk as usual; such a page is mostly incompressible anyway. */
+#define ZSWAP_BUDGET (512 * 1024)
+#define ZSWAP_ENTRY_MAX 1024
+
+/* Whether evicted pages may use the zswap tier (-no-zswap clears it). */
+bool vm_zswap = true;
+
+/* A compressed page.  After fork several pages may share one. */
+struct zswap_entry {
+	unsigned ref_cnt;           /* Pages referring to this entry. */
+	size_t len;                 /* Bytes in DATA. */
+	uint8_t data[];             /* Output of lz_compress(). */
+};
+
+/* Compressor state and staging buffer. */
+static struct lz_state zswap_lz;
+static uint8_t zswap_buf[ZSWAP_ENTRY_MAX];
+static size_t zswap_bytes;          /* Bytes held by entries. */
+
+/* Statistics, protected by SWAP_LOCK. */
+static long long swap_out_cnt;      /* Pages written to swap. */
+static long long swap_cluster_cnt;  /* Clustered write passes. */
+static long long swap_in_cnt;       /* Pages read back on a fault. */
+static long long swap_prefetch_cnt; /* Pages read ahead. */
+static long long zswap_out_cnt;     /* Pages compressed into memory. */
+static long long zswap_in_cnt;      /* Pages decompressed on a fault. */
+static long long zswap_reject_cnt;  /* Pages that went to disk instead. */
+static long long zswap_raw_bytes;   /* Bytes compressed... */
+static long long zswap_packed_bytes;/* ...and what they shrank to. */
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	size_t slot_cnt;
+
+	lock_init (&swap_lock);
+	swap_disk = disk_get (1, 1);
+	if (swap_disk == NULL)
+		return;
+
+	slot_cnt = disk_size (swap_disk) / SECTORS_PER_SLOT;
+	swap_map = bitmap_create (slot_cnt);
+	slot_pages = calloc (slot_cnt, sizeof *slot_pages);
+	slot_refs = calloc (slot_cnt, sizeof *slot_refs);
+	if (swap_map == NULL || slot_pages == NULL || slot_refs == NULL)
+		PANIC ("swap: cannot allocate slot table for %zu slots", slot_cnt);
 }
 
 /* Initialize the file mapping */
@@ -31,22 +101,249 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = SWAP_SLOT_NONE;
+	anon_page->zentry = NULL;
+
+	/* A fresh anonymous page reads as zeros; a page initializer, if
+	 * any, fills in its part on top of that. */
+	memset (kva, 0, PGSIZE);
+	return true;
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Drops PAGE's reference to SLOT, releasing the slot with the last
+ * one.  SWAP_LOCK must be held. */
+static void
+slot_put (size_t slot, struct page *page) {
+	if (slot_pages[slot] == page)
+		slot_pages[slot] = NULL;
+	if (--slot_refs[slot] == 0) {
+		bitmap_reset (swap_map, slot);
+		slot_pages[slot] = NULL;
+	}
+}
+
+/* Compresses the page in PAGE's frame into a new zswap entry.
+ * Returns false, leaving PAGE untouched, if the page does not
+ * compress well enough or the tier is full. */
+static bool
+zswap_store (struct page *page) {
+	struct zswap_entry *entry = NULL;
+	size_t len;
+
+	lock_acquire (&swap_lock);
+	len = lz_compress (page->frame->kva, PGSIZE, zswap_buf,
+			ZSWAP_ENTRY_MAX - sizeof *entry, &zswap_lz);
+	if (len > 0 && zswap_bytes + len <= ZSWAP_BUDGET)
+		entry = malloc (sizeof *entry + len);
+	if (entry == NULL) {
+		zswap_reject_cnt++;
+		lock_release (&swap_lock);
+		return false;
+	}
+	entry->ref_cnt = 1;
+	entry->len = len;
+	memcpy (entry->data, zswap_buf, len);
+	zswap_bytes += len;
+	zswap_out_cnt++;
+	zswap_raw_bytes += PGSIZE;
+	zswap_packed_bytes += len;
+	page->anon.zentry = entry;
+	page->owner->spt.swapped++;
+	lock_release (&swap_lock);
+	return true;
+}
+
+/* Drops PAGE's reference to its zswap entry, freeing the entry with
+ * the last one.  SWAP_LOCK must be held. */
+static void
+zswap_put (struct page *page) {
+	struct zswap_entry *entry = page->anon.zentry;
+
+	if (--entry->ref_cnt == 0) {
+		zswap_bytes -= entry->len;
+		free (entry);
+	}
+	page->anon.zentry = NULL;
+	page->owner->spt.swapped--;
+}
+
+/* Returns true if PAGE's contents live in swap, on disk or
+ * compressed in memory. */
+bool
+anon_is_swapped (const struct page *page) {
+	return page->anon.slot != SWAP_SLOT_NONE || page->anon.zentry != NULL;
+}
+
+/* Makes anonymous page DST, which has no frame, refer to the swap
+ * slot or zswap entry that SRC is stored in.  Used to share
+ * swapped-out memory across fork without reading it back. */
+void
+anon_share_slot (struct page *src, struct page *dst) {
+	lock_acquire (&swap_lock);
+	if (src->anon.zentry != NULL) {
+		dst->anon.zentry = src->anon.zentry;
+		dst->anon.zentry->ref_cnt++;
+	} else {
+		dst->anon.slot = src->anon.slot;
+		slot_refs[src->anon.slot]++;
+	}
+	dst->owner->spt.swapped++;
+	lock_release (&swap_lock);
+}
+
+/* Reads slot SLOT into KVA. */
+static void
+slot_read (size_t slot, void *kva) {
+	for (size_t i = 0; i < SECTORS_PER_SLOT; i++)
+		disk_read (swap_disk, slot * SECTORS_PER_SLOT + i,
+				(uint8_t *) kva + i * DISK_SECTOR_SIZE);
+}
+
+/* Swap in the page by read contents from the swap disk.
+ * The slots that follow it usually hold pages of the same process
+ * that were evicted in the same cluster, so those are read in too
+ * while the disk head is there, as long as free frames last. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	struct thread *t = thread_current ();
+	struct page *ahead[SWAP_READAHEAD];
+	size_t ahead_cnt = 0;
+	size_t slot = anon_page->slot;
+
+	if (anon_page->zentry != NULL) {
+		struct zswap_entry *entry = anon_page->zentry;
+		if (!lz_decompress (entry->data, entry->len, kva, PGSIZE))
+			PANIC ("zswap: corrupt entry for page %p", page->va);
+		lock_acquire (&swap_lock);
+		zswap_put (page);
+		zswap_in_cnt++;
+		lock_release (&swap_lock);
+		return true;
+	}
+	if (slot == SWAP_SLOT_NONE)
+		return false;
+
+	slot_read (slot, kva);
+
+	lock_acquire (&swap_lock);
+	slot_put (slot, page);
+	anon_page->slot = SWAP_SLOT_NONE;
+	page->owner->spt.swapped--;
+	swap_in_cnt++;
+	if (!t->swap_reading_ahead) {
+		for (size_t i = 1; i <= SWAP_READAHEAD && slot + i < bitmap_size (swap_map); i++) {
+			struct page *next = slot_pages[slot + i];
+			if (next == NULL || next->owner != page->owner)
+				break;
+			ahead[ahead_cnt++] = next;
+		}
+	}
+	lock_release (&swap_lock);
+
+	/* The neighbours are swapped in by this thread, so a flag of its
+	 * own keeps them from reading ahead in turn without holding back
+	 * other threads' swap-ins. */
+	if (ahead_cnt > 0) {
+		t->swap_reading_ahead = true;
+		for (size_t i = 0; i < ahead_cnt; i++) {
+			if (!vm_prefetch_page (ahead[i]))
+				break;
+			lock_acquire (&swap_lock);
+			swap_prefetch_cnt++;
+			lock_release (&swap_lock);
+		}
+		t->swap_reading_ahead = false;
+	}
+	return true;
+}
+
+/* Writes the first CNT pages of PAGES to a run of consecutive swap
+ * slots in one pass, or to a shorter run if no run that long is
+ * free.  Returns the number of leading pages written. */
+static size_t
+slot_write_cluster (struct page **pages, size_t cnt) {
+	size_t first = BITMAP_ERROR;
+
+	if (swap_disk == NULL)
+		return 0;
+
+	lock_acquire (&swap_lock);
+	for (; cnt > 0; cnt--) {
+		first = bitmap_scan_and_flip (swap_map, 0, cnt, false);
+		if (first != BITMAP_ERROR)
+			break;
+	}
+	for (size_t i = 0; i < cnt; i++) {
+		slot_pages[first + i] = pages[i];
+		slot_refs[first + i] = 1;
+		pages[i]->owner->spt.swapped++;
+	}
+	if (cnt > 0) {
+		swap_out_cnt += cnt;
+		swap_cluster_cnt++;
+	}
+	lock_release (&swap_lock);
+
+	for (size_t i = 0; i < cnt; i++) {
+		const uint8_t *kva = pages[i]->frame->kva;
+		for (size_t j = 0; j < SECTORS_PER_SLOT; j++)
+			disk_write (swap_disk, (first + i) * SECTORS_PER_SLOT + j,
+					kva + j * DISK_SECTOR_SIZE);
+		pages[i]->anon.slot = first + i;
+	}
+	return cnt;
+}
+
+/* Swaps out the first CNT pages of PAGES, all anonymous and already
+ * unmapped.  Leading pages that compress well are kept in the zswap
+ * tier; the rest go to the swap disk together.  Returns the number of
+ * leading pages swapped out, which is 0 if swap is full. */
+size_t
+anon_swap_out_cluster (struct page **pages, size_t cnt) {
+	size_t stored = 0;
+
+	while (vm_zswap && stored < cnt && zswap_store (pages[stored]))
+		stored++;
+	return stored + slot_write_cluster (pages + stored, cnt - stored);
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	return anon_swap_out_cluster (&page, 1) == 1;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	/* Wait out a concurrent eviction first; afterwards the slot is
+	 * stable. */
+	vm_frame_free (page);
+	lock_acquire (&swap_lock);
+	if (anon_page->zentry != NULL)
+		zswap_put (page);
+	if (anon_page->slot != SWAP_SLOT_NONE) {
+		slot_put (anon_page->slot, page);
+		anon_page->slot = SWAP_SLOT_NONE;
+		page->owner->spt.swapped--;
+	}
+	lock_release (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+vm_anon_print_stats (void) {
+	printf ("Swap: %lld pages out in %lld passes, %lld in, %lld read ahead\n",
+			swap_out_cnt, swap_cluster_cnt, swap_in_cnt, swap_prefetch_cnt);
+	printf ("Zswap: %lld pages stored, %lld loaded, %lld rejected, "
+			"%lld disk sectors saved\n", zswap_out_cnt, zswap_in_cnt,
+			zswap_reject_cnt,
+			(zswap_out_cnt + zswap_in_cnt) * (long long) SECTORS_PER_SLOT);
+	if (zswap_packed_bytes > 0)
+		printf ("Zswap: compression ratio %lld.%02lld:1\n",
+				zswap_raw_bytes / zswap_packed_bytes,
+				zswap_raw_bytes * 100 / zswap_packed_bytes % 100);
 }
@@ -1,6 +1,29 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include <round.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Bounds of the readahead window, in pages. */
+#define READAHEAD_MIN 2
+#define READAHEAD_MAX 16
+
+/* One mmap() of a file.  It is the owner data of the REGION_MMAP
+ * region that covers it, and lives until the region is unmapped. */
+struct mmap_file {
+	struct file *file;          /* Private handle from file_reopen(). */
+	uint8_t *start;             /* First mapped page. */
+	size_t page_cnt;            /* Number of mapped pages. */
+	off_t offset;               /* File offset mapped at START. */
+	off_t file_bytes;           /* Bytes of the mapping backed by FILE. */
+	size_t ra_next;             /* Page index that continues the
+	                               current sequential run. */
+	size_t ra_window;           /* Pages read ahead on the last fault. */
+};
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -22,37 +45,199 @@ vm_file_init (void) {
 /* Initialize the file backed page */
 bool
 file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+	struct spt_region *region = spt_region_find (&page->owner->spt, page->va);
+	struct file_page *file_page = &page->file;
+	struct mmap_file *map;
+	off_t page_start;
+
 	/* Set up the handler */
 	page->operations = &file_ops;
 
-	struct file_page *file_page = &page->file;
+	ASSERT (region != NULL && region->type == REGION_MMAP);
+	map = region->aux;
+	page_start = (uint8_t *) page->va - map->start;
+	file_page->map = map;
+	file_page->ofs = map->offset + page_start;
+	file_page->read_bytes = 0;
+	if (page_start < map->file_bytes)
+		file_page->read_bytes = map->file_bytes - page_start < PGSIZE
+			? map->file_bytes - page_start : PGSIZE;
+	return file_backed_swap_in (page, kva);
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	if (file_read_at (file_page->map->file, kva, file_page->read_bytes,
+				file_page->ofs) != (off_t) file_page->read_bytes)
+		return false;
+	memset ((uint8_t *) kva + file_page->read_bytes, 0,
+			PGSIZE - file_page->read_bytes);
+	return true;
+}
+
+/* Writes PAGE back to its file if, and only if, it is dirty. */
+static bool
+file_write_back (struct page *page) {
+	struct file_page *file_page = &page->file;
+	uint64_t *pml4 = page->owner->pml4;
+
+	if (!pml4_is_dirty (pml4, page->va))
+		return true;
+	if (file_write_at (file_page->map->file, page->frame->kva,
+				file_page->read_bytes, file_page->ofs)
+			!= (off_t) file_page->read_bytes)
+		return false;
+	pml4_set_dirty (pml4, page->va, false);
+	return true;
 }
 
 /* Swap out the page by writeback contents to the file. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	return file_write_back (page);
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	if (vm_frame_pin (page) != NULL) {
+		file_write_back (page);
+		vm_frame_unpin (page);
+	}
+	vm_frame_free (page);
+}
+
+/* Called after a fault brought in file-backed PAGE.  A fault on the
+ * page that continues the previous run doubles the readahead window,
+ * anything else collapses it; the window's pages are then prefetched
+ * into free frames, so a sequential reader faults once per window. */
+void
+vm_file_readahead (struct page *page) {
+	struct mmap_file *map = page->file.map;
+	struct supplemental_page_table *spt = &page->owner->spt;
+	size_t idx = ((uint8_t *) page->va - map->start) / PGSIZE;
+	size_t i;
+
+	if (idx == map->ra_next)
+		map->ra_window = map->ra_window * 2 < READAHEAD_MIN
+			? READAHEAD_MIN : map->ra_window * 2;
+	else
+		map->ra_window = 0;
+	if (map->ra_window > READAHEAD_MAX)
+		map->ra_window = READAHEAD_MAX;
+	map->ra_next = idx + map->ra_window + 1;
+
+	for (i = idx + 1; i <= idx + map->ra_window && i < map->page_cnt; i++) {
+		struct page *p = spt_find_page (spt, map->start + i * PGSIZE);
+
+		if (p != NULL && p->frame == NULL && !vm_prefetch_page (p))
+			break;
+	}
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *start = addr, *end, *va;
+	struct mmap_file *map;
+	size_t page_cnt;
+	off_t file_len;
+
+	if (start == NULL || pg_ofs (start) != 0 || length == 0
+			|| offset < 0 || pg_ofs (offset) != 0)
+		return NULL;
+	page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	end = start + page_cnt * PGSIZE;
+	if (end <= start || !is_user_vaddr (end - 1)
+			|| spt_region_overlaps (spt, start, end))
+		return NULL;
+	file_len = file_length (file);
+	if (file_len == 0)
+		return NULL;
+
+	map = malloc (sizeof *map);
+	if (map == NULL)
+		return NULL;
+	map->file = file_reopen (file);
+	if (map->file == NULL)
+		goto fail_map;
+	map->start = start;
+	map->page_cnt = page_cnt;
+	map->offset = offset;
+	map->file_bytes = 0;
+	if (offset < file_len)
+		map->file_bytes = (off_t) length < file_len - offset
+			? (off_t) length : file_len - offset;
+	map->ra_next = 0;
+	map->ra_window = 0;
+
+	if (!spt_region_insert (spt, start, end, REGION_MMAP, map))
+		goto fail_file;
+	for (va = start; va < end; va += PGSIZE)
+		if (!vm_alloc_page (VM_FILE, va, writable))
+			goto fail_pages;
+	return addr;
+
+fail_pages:
+	while (va > start) {
+		va -= PGSIZE;
+		spt_remove_page (spt, spt_find_page (spt, va));
+	}
+	spt_region_remove (spt, start);
+fail_file:
+	file_close (map->file);
+fail_map:
+	free (map);
+	return NULL;
+}
+
+/* Gives DST, the table of a child being forked, its own copy of the
+ * parent's mapping SRC: same range and offset, a handle of its own.
+ * The pages are copied separately. */
+bool
+mmap_copy_region (struct supplemental_page_table *dst,
+		const struct spt_region *src) {
+	struct mmap_file *map = malloc (sizeof *map);
+
+	if (map == NULL)
+		return false;
+	*map = *(struct mmap_file *) src->aux;
+	map->file = file_reopen (map->file);
+	if (map->file != NULL) {
+		if (spt_region_insert (dst, src->start, src->end, REGION_MMAP, map))
+			return true;
+		file_close (map->file);
+	}
+	free (map);
+	return false;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct spt_region *region = spt_region_find (spt, addr);
+	struct mmap_file *map;
+	size_t i;
+
+	if (region == NULL || region->type != REGION_MMAP || region->start != addr)
+		return;
+	map = region->aux;
+
+	/* Removing each page writes it back if it is dirty, from its
+	 * frame rather than through the user mapping, so that nothing
+	 * here can fault. */
+	for (i = 0; i < map->page_cnt; i++) {
+		struct page *page = spt_find_page (spt, map->start + i * PGSIZE);
+		if (page != NULL)
+			spt_remove_page (spt, page);
+	}
+	spt_region_remove (spt, addr);
+	file_close (map->file);
+	free (map);
 }
@@ -8,6 +8,9 @@
  * function.
  * */
 
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
 #include "vm/vm.h"
 #include "vm/uninit.h"
 
@@ -62,7 +65,14 @@ uninit_initialize (struct page *page, void *kva) {
  * PAGE will be freed by the caller. */
 static void
 uninit_destroy (struct page *page) {
-	struct uninit_page *uninit UNUSED = &page->uninit;
-	/* TODO: Fill this function.
-	 * TODO: If you don't have anything to do, just return. */
+	struct uninit_page *uninit = &page->uninit;
+
+	/* AUX belongs to the page until its initializer runs; an
+	 * initializer that is never called never gets to free it. */
+	free (uninit->aux);
+
+	/* A page that was only ever read may still map the shared zero
+	 * page, which pml4_destroy() must not free. */
+	if (page->owner->pml4 != NULL)
+		pml4_clear_page (page->owner->pml4, page->va);
 }
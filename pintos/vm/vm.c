@@ -1,9 +1,62 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
 
+/* Every frame handed out to a user page, in clock order.  CLOCK_HAND
+ * is the next frame the eviction clock will look at.  FRAME_LOCK
+ * protects both, and every frame<->page link.  An eviction drops
+ * FRAME_LOCK while it writes its victim out; the victim is marked
+ * evicting meanwhile, and EVICT_DONE is signaled when it finishes.
+ * EVICT_CNT counts the evictions in progress. */
+static struct list frame_table;
+static struct list_elem *clock_hand;
+static struct lock frame_lock;
+static struct condition evict_done;
+static size_t evict_cnt;
+
+/* Every live process's supplemental page table, so memory usage can
+ * be reported by pid.  OVER_LIMIT_CNT counts the processes above
+ * their resident set soft limit.  FRAME_LOCK protects both. */
+static struct list proc_list;
+static size_t over_limit_cnt;
+
+/* One zeroed page, mapped read-only wherever an untouched anonymous
+ * page is read.  It is never in the frame table and never freed. */
+static void *zero_page;
+
+/* Zero page statistics. */
+static long long zero_map_cnt;      /* Read faults served by ZERO_PAGE. */
+static long long zero_break_cnt;    /* Of those, later written. */
+
+/* Copy-on-write fork statistics. */
+static long long cow_fork_cnt;      /* Address spaces copied. */
+static long long cow_shared_cnt;    /* Frames and swap slots shared. */
+static long long cow_copied_cnt;    /* Pages copied on a write fault. */
+static long long cow_upgraded_cnt;  /* Pages made writable in place. */
+
+/* Evictions taken from processes over their soft limit. */
+static long long rss_limit_evict_cnt;
+
+/* Largest size, in bytes, a user stack may grow to (-sl). */
+size_t vm_stack_limit = 1024 * 1024;
+
+/* Default resident set soft limit in pages (-rss), 0 for none. */
+size_t vm_rss_limit;
+
+/* Most newly grown stack pages brought in by one growth fault. */
+#define STACK_PREFAULT_PAGES 16
+
+/* Size of the window, in pages, that a fault on a segment page
+ * brings in around itself.  Must be a power of two. */
+#define FAULT_AROUND_PAGES 8
+
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
 void
@@ -15,7 +68,14 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	list_init (&frame_table);
+	clock_hand = list_end (&frame_table);
+	lock_init (&frame_lock);
+	cond_init (&evict_done);
+	list_init (&proc_list);
+	zero_page = palloc_get_page (PAL_ZERO);
+	if (zero_page == NULL)
+		PANIC ("vm: cannot allocate the zero page");
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -36,10 +96,17 @@ page_get_type (struct page *page) {
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
 static struct frame *vm_evict_frame (void);
+static void frame_release (struct frame *frame);
+static bool vm_install_frame (struct page *page, struct frame *frame);
+static void vm_fault_around (struct supplemental_page_table *spt,
+		struct page *page);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
- * `vm_alloc_page`. */
+ * `vm_alloc_page`.
+ * A non-null AUX must come from malloc(): on success the page owns it,
+ * and it is freed by INIT or, if the page is never touched, by the
+ * uninit destructor. */
 bool
 vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 		vm_initializer *init, void *aux) {
@@ -50,11 +117,32 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		bool (*initializer) (struct page *, enum vm_type, void *);
+		struct page *page;
+
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
+
+		page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, pg_round_down (upage), init, type, aux, initializer);
+		page->writable = writable;
+		page->owner = thread_current ();
 
-		/* TODO: Insert the page into the spt. */
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
@@ -62,82 +150,792 @@ err:
 
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page key;
+	struct hash_elem *e;
 
-	return page;
+	key.va = pg_round_down (va);
+	e = hash_find (&spt->pages, &key.spt_elem);
+	return e != NULL ? hash_entry (e, struct page, spt_elem) : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
-
-	return succ;
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	ASSERT (pg_ofs (page->va) == 0);
+	return hash_insert (&spt->pages, &page->spt_elem) == NULL;
 }
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	hash_delete (&spt->pages, &page->spt_elem);
 	vm_dealloc_page (page);
+}
+
+/* Returns the index of the first region in SPT that ends above VA,
+ * or SPT->region_cnt if there is none.  Regions do not overlap, so
+ * sorting them by start also sorts them by end. */
+static size_t
+region_lower_bound (const struct supplemental_page_table *spt, const void *va) {
+	size_t lo = 0, hi = spt->region_cnt;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if ((const uint8_t *) spt->regions[mid].end <= (const uint8_t *) va)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Returns true if any region of SPT intersects [START, END). */
+bool
+spt_region_overlaps (struct supplemental_page_table *spt,
+		const void *start, const void *end) {
+	size_t i = region_lower_bound (spt, start);
+	return i < spt->region_cnt
+		&& (const uint8_t *) spt->regions[i].start < (const uint8_t *) end;
+}
+
+/* Returns the region of SPT that contains VA, or NULL. */
+struct spt_region *
+spt_region_find (struct supplemental_page_table *spt, const void *va) {
+	size_t i = region_lower_bound (spt, va);
+	if (i < spt->region_cnt
+			&& (const uint8_t *) spt->regions[i].start <= (const uint8_t *) va)
+		return &spt->regions[i];
+	return NULL;
+}
+
+/* Records the page-aligned region [START, END) of TYPE in SPT, with
+ * AUX as its owner data, and returns it so that the caller can fill
+ * in the type-specific fields.  The pointer is good until the next
+ * insertion or removal.  Returns NULL if the region would overlap an
+ * existing one or if memory is exhausted. */
+struct spt_region *
+spt_region_insert (struct supplemental_page_table *spt, void *start,
+		void *end, enum spt_region_type type, void *aux) {
+	size_t i;
+
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+	ASSERT ((uint8_t *) start < (uint8_t *) end);
+
+	if (spt_region_overlaps (spt, start, end))
+		return NULL;
+
+	if (spt->region_cnt == spt->region_cap) {
+		size_t cap = spt->region_cap ? spt->region_cap * 2 : 8;
+		struct spt_region *regions =
+			realloc (spt->regions, cap * sizeof *regions);
+		if (regions == NULL)
+			return NULL;
+		spt->regions = regions;
+		spt->region_cap = cap;
+	}
+
+	i = region_lower_bound (spt, start);
+	memmove (&spt->regions[i + 1], &spt->regions[i],
+			(spt->region_cnt - i) * sizeof *spt->regions);
+	spt->regions[i] = (struct spt_region) {
+		.start = start,
+		.end = end,
+		.type = type,
+		.aux = aux,
+	};
+	spt->region_cnt++;
+	return &spt->regions[i];
+}
+
+/* Forgets the region of SPT that begins at START, if any.  The pages
+ * inside it are not touched. */
+void
+spt_region_remove (struct supplemental_page_table *spt, void *start) {
+	size_t i = region_lower_bound (spt, start);
+
+	if (i < spt->region_cnt && spt->regions[i].start == start) {
+		memmove (&spt->regions[i], &spt->regions[i + 1],
+				(spt->region_cnt - i - 1) * sizeof *spt->regions);
+		spt->region_cnt--;
+	}
+}
+
+/* Moves the clock hand one frame forward, wrapping around, and
+ * returns the frame it passed over.  FRAME_LOCK must be held and the
+ * frame table must not be empty. */
+static struct frame *
+clock_advance (void) {
+	if (clock_hand == list_end (&frame_table))
+		clock_hand = list_begin (&frame_table);
+	struct frame *frame = list_entry (clock_hand, struct frame, elem);
+	clock_hand = list_next (clock_hand);
+	return frame;
+}
+
+/* Returns the resident set soft limit that applies to SPT, in
+ * pages, or 0 if there is none. */
+static size_t
+rss_limit (const struct supplemental_page_table *spt) {
+	return spt->rss_limit != 0 ? spt->rss_limit : vm_rss_limit;
+}
+
+/* Returns true if SPT holds more frames than its soft limit. */
+static bool
+over_limit (const struct supplemental_page_table *spt) {
+	size_t limit = rss_limit (spt);
+	return limit != 0 && spt->rss > limit;
+}
+
+/* Sets the resident set size and the soft limit of SPT, keeping
+ * OVER_LIMIT_CNT in step.  FRAME_LOCK must be held. */
+static void
+rss_set (struct supplemental_page_table *spt, size_t rss, size_t limit) {
+	bool was_over = over_limit (spt);
+
+	spt->rss = rss;
+	spt->rss_limit = limit;
+	if (over_limit (spt) != was_over) {
+		if (was_over)
+			over_limit_cnt--;
+		else
+			over_limit_cnt++;
+	}
+}
+
+/* Adds PAGE to the pages that map FRAME.  FRAME_LOCK must be held. */
+static void
+frame_link (struct frame *frame, struct page *page) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+
+	list_push_back (&frame->pages, &page->frame_elem);
+	frame->ref_cnt++;
+	if (frame->page == NULL)
+		frame->page = page;
+	page->frame = frame;
+
+	rss_set (spt, spt->rss + 1, spt->rss_limit);
+	if (frame->ref_cnt == 2)
+		frame->page->owner->spt.shared++;
+	if (frame->ref_cnt >= 2)
+		spt->shared++;
+}
+
+/* Removes PAGE from the pages that map its frame.  The frame itself
+ * is left alone, even if that was its last page.  FRAME_LOCK must be
+ * held. */
+static void
+frame_unlink (struct page *page) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+	struct frame *frame = page->frame;
+
+	if (frame->ref_cnt >= 2)
+		spt->shared--;
+	rss_set (spt, spt->rss - 1, spt->rss_limit);
+
+	list_remove (&page->frame_elem);
+	frame->ref_cnt--;
+	if (frame->page == page)
+		frame->page = frame->ref_cnt > 0
+			? list_entry (list_front (&frame->pages), struct page, frame_elem)
+			: NULL;
+	page->frame = NULL;
+	if (frame->ref_cnt == 1)
+		frame->page->owner->spt.shared--;
+}
+
+/* Waits until PAGE's frame, if it has one, is not being evicted.
+ * Afterwards PAGE has no frame, or has its old one back if the
+ * eviction failed.  FRAME_LOCK must be held. */
+static void
+frame_settle (struct page *page) {
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&evict_done, &frame_lock);
+}
+
+/* Feeds one accessed-bit sample of a page of SPT into its working
+ * set estimate.  Once about as many samples as SPT has frames have
+ * come in, i.e. the clock has passed over all of them, the number
+ * found accessed is averaged into WS.  FRAME_LOCK must be held. */
+static void
+ws_sample (struct supplemental_page_table *spt, bool accessed) {
+	spt->ws_seen++;
+	if (accessed)
+		spt->ws_hits++;
+	if (spt->ws_seen >= spt->rss) {
+		spt->ws = (spt->ws + spt->ws_hits + 1) / 2;
+		spt->ws_seen = spt->ws_hits = 0;
+	}
+}
+
+/* Returns true if any page mapping FRAME was accessed since the last
+ * call, clearing the accessed bits.  Each bit tested is also a
+ * working set sample for the page's owner.  FRAME_LOCK must be
+ * held. */
+static bool
+frame_test_accessed (struct frame *frame) {
+	bool accessed = false;
+
+	for (struct list_elem *e = list_begin (&frame->pages);
+			e != list_end (&frame->pages); e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		bool hit = pml4_is_accessed (page->owner->pml4, page->va);
+		if (hit) {
+			pml4_set_accessed (page->owner->pml4, page->va, false);
+			accessed = true;
+		}
+		ws_sample (&page->owner->spt, hit);
+	}
+	return accessed;
+}
+
+/* Re-maps PAGE to KVA with write permission RW, keeping the dirty
+ * and accessed bits of the old mapping. */
+static bool
+page_remap (struct page *page, void *kva, bool rw) {
+	uint64_t *pml4 = page->owner->pml4;
+	bool dirty = pml4_is_dirty (pml4, page->va);
+	bool accessed = pml4_is_accessed (pml4, page->va);
+
+	pml4_clear_page (pml4, page->va);
+	if (!pml4_set_page (pml4, page->va, kva, rw))
+		return false;
+	if (dirty)
+		pml4_set_dirty (pml4, page->va, true);
+	if (accessed)
+		pml4_set_accessed (pml4, page->va, true);
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Returns true if PAGE is an anonymous page that was never touched
+ * and has nothing to load, i.e. it would start out all zeros. */
+static bool
+is_zero_fill (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& VM_TYPE (page->uninit.type) == VM_ANON
+		&& page->uninit.init == NULL;
+}
+
+/* Returns true if PAGE is mapped writable in its owner's page table. */
+static bool
+page_is_writable (struct page *page) {
+	uint64_t *pte = pml4e_walk (page->owner->pml4, (uint64_t) page->va, 0);
+	return pte != NULL && is_writable (pte);
+}
+
+/* Returns true if FRAME may be evicted at all.  Frames shared after
+ * fork are only taken if they are anonymous, since swap can hand one
+ * slot to all of their pages.  FRAME_LOCK must be held. */
+static bool
+is_evictable (struct frame *frame) {
+	struct page *page = frame->page;
+
+	if (frame->pin_cnt > 0 || page == NULL)
+		return false;
+	return frame->ref_cnt == 1
+		|| VM_TYPE (page->operations->type) == VM_ANON;
+}
+
+/* Looks for a victim among the frames of processes over their
+ * resident set soft limit, sweeping the clock once.  An idle frame is
+ * preferred, but if all of them were recently used the first one seen
+ * is taken anyway: being over the limit outweighs the second chance.
+ * FRAME_LOCK must be held. */
+static struct frame *
+get_victim_over_limit (void) {
+	size_t budget = list_size (&frame_table);
+	struct frame *fallback = NULL;
+
+	while (budget-- > 0) {
+		struct frame *frame = clock_advance ();
+
+		if (!is_evictable (frame) || !over_limit (&frame->page->owner->spt))
+			continue;
+		if (!frame_test_accessed (frame))
+			return frame;
+		if (fallback == NULL)
+			fallback = frame;
+	}
+	return fallback;
+}
+
+/* Get the struct frame, that will be evicted.
+ * Processes over their soft limit give up frames first.  Otherwise,
+ * second chance: a frame whose accessed bit is set gets the bit
+ * cleared and is passed over once.  After two full sweeps every
+ * unpinned frame has lost its bit, so the search is bounded.
+ * FRAME_LOCK must be held. */
 static struct frame *
 vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	size_t budget = 2 * list_size (&frame_table);
+
+	if (over_limit_cnt > 0) {
+		struct frame *frame = get_victim_over_limit ();
+		if (frame != NULL) {
+			rss_limit_evict_cnt++;
+			return frame;
+		}
+	}
+
+	while (budget-- > 0) {
+		struct frame *frame = clock_advance ();
+
+		if (!is_evictable (frame) || frame_test_accessed (frame))
+			continue;
+		return frame;
+	}
+	return NULL;
+}
+
+/* Returns true if FRAME holds an unshared anonymous page that can be
+ * evicted right now.  FRAME_LOCK must be held. */
+static bool
+is_idle_anon (struct frame *frame) {
+	struct page *page = frame->page;
+	return frame->pin_cnt == 0 && page != NULL && frame->ref_cnt == 1
+		&& VM_TYPE (page->operations->type) == VM_ANON
+		&& !pml4_is_accessed (page->owner->pml4, page->va);
+}
+
+/* Swaps out VICTIM's anonymous page together with the idle anonymous
+ * pages in the frames right after it on the clock, writing them to
+ * consecutive swap slots in one pass.  The extra frames are returned
+ * to the user pool, so the next few faults need no eviction.
+ * Returns false if nothing could be written.  FRAME_LOCK must be
+ * held, and is dropped during the write; VICTIM is pinned and its
+ * page unmapped on entry. */
+static bool
+evict_anon_cluster (struct frame *victim) {
+	struct frame *frames[SWAP_CLUSTER];
+	struct page *pages[SWAP_CLUSTER];
+	size_t cnt = 0, written;
 
-	return victim;
+	frames[cnt] = victim;
+	pages[cnt++] = victim->page;
+	while (cnt < SWAP_CLUSTER && clock_hand != list_end (&frame_table)) {
+		struct frame *frame = list_entry (clock_hand, struct frame, elem);
+		if (!is_idle_anon (frame))
+			break;
+		pml4_clear_page (frame->page->owner->pml4, frame->page->va);
+		frame->pin_cnt++;
+		frame->evicting = true;
+		frames[cnt] = frame;
+		pages[cnt++] = frame->page;
+		clock_hand = list_next (clock_hand);
+	}
+
+	lock_release (&frame_lock);
+	written = anon_swap_out_cluster (pages, cnt);
+	lock_acquire (&frame_lock);
+
+	for (size_t i = 0; i < cnt; i++) {
+		struct page *page = pages[i];
+		if (i > 0) {
+			frames[i]->evicting = false;
+			frames[i]->pin_cnt--;
+		}
+		if (i >= written) {
+			/* Swap is full: put the page back. */
+			pml4_set_page (page->owner->pml4, page->va, frames[i]->kva,
+					page->writable);
+			continue;
+		}
+		frame_unlink (page);
+		if (i > 0)
+			frame_release (frames[i]);
+	}
+	return written > 0;
+}
+
+/* Swaps out VICTIM, an anonymous frame shared by several processes
+ * after fork, to a single slot that all of its pages then refer to.
+ * FRAME_LOCK must be held, and is dropped during the write; VICTIM is
+ * pinned and its pages mapped read-only on entry. */
+static bool
+evict_shared_anon (struct frame *victim) {
+	struct page *first = victim->page;
+	struct list_elem *e;
+	bool ok;
+
+	for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		pml4_clear_page (page->owner->pml4, page->va);
+	}
+
+	lock_release (&frame_lock);
+	ok = anon_swap_out_cluster (&first, 1) == 1;
+	lock_acquire (&frame_lock);
+
+	if (!ok) {
+		for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+				e = list_next (e)) {
+			struct page *page = list_entry (e, struct page, frame_elem);
+			pml4_set_page (page->owner->pml4, page->va, victim->kva, false);
+		}
+		return false;
+	}
+
+	while (victim->ref_cnt > 0) {
+		struct page *page = list_entry (list_back (&victim->pages),
+				struct page, frame_elem);
+		if (page != first)
+			anon_share_slot (first, page);
+		frame_unlink (page);
+	}
+	return true;
 }
 
 /* Evict one page and return the corresponding frame.
+ * The victim is chosen and unmapped with FRAME_LOCK held, but the
+ * lock is dropped while the page is written out, so that faults and
+ * frame allocations elsewhere do not wait for the disk.  Meanwhile
+ * the frame is pinned and marked evicting, and whoever needs one of
+ * its pages waits in frame_settle().  The frame comes back pinned.
  * Return NULL on error.*/
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+	struct frame *victim;
+	struct page *page;
+	bool ok;
 
-	return NULL;
+	lock_acquire (&frame_lock);
+	for (;;) {
+		victim = list_empty (&frame_table) ? NULL : vm_get_victim ();
+		if (victim != NULL || evict_cnt == 0)
+			break;
+		/* Everything is pinned, but evictions in progress will
+		 * free some frames up. */
+		cond_wait (&evict_done, &frame_lock);
+	}
+	if (victim == NULL) {
+		lock_release (&frame_lock);
+		return NULL;
+	}
+	victim->pin_cnt++;
+	victim->evicting = true;
+	evict_cnt++;
+
+	/* Unmap first so the owner cannot modify the page while it is
+	 * being written out.  The dirty bit survives in the PTE. */
+	page = victim->page;
+	if (victim->ref_cnt > 1)
+		ok = evict_shared_anon (victim);
+	else if (VM_TYPE (page->operations->type) == VM_ANON) {
+		pml4_clear_page (page->owner->pml4, page->va);
+		ok = evict_anon_cluster (victim);
+	} else {
+		pml4_clear_page (page->owner->pml4, page->va);
+		lock_release (&frame_lock);
+		ok = page->operations->swap_out != NULL && swap_out (page);
+		lock_acquire (&frame_lock);
+		if (ok)
+			frame_unlink (page);
+		else
+			pml4_set_page (page->owner->pml4, page->va, victim->kva,
+					page->writable);
+	}
+
+	victim->evicting = false;
+	evict_cnt--;
+	if (!ok)
+		victim->pin_cnt--;
+	cond_broadcast (&evict_done, &frame_lock);
+	lock_release (&frame_lock);
+	return ok ? victim : NULL;
+}
+
+/* Takes a free page from the user pool and adds it to the frame
+ * table, pinned.  Returns NULL if the pool is empty. */
+static struct frame *
+frame_alloc (void) {
+	struct frame *frame;
+	void *kva = palloc_get_page (PAL_USER);
+
+	if (kva == NULL)
+		return NULL;
+
+	frame = malloc (sizeof *frame);
+	if (frame == NULL) {
+		palloc_free_page (kva);
+		return NULL;
+	}
+	frame->kva = kva;
+	frame->page = NULL;
+	list_init (&frame->pages);
+	frame->ref_cnt = 0;
+	frame->pin_cnt = 1;
+	frame->evicting = false;
+
+	lock_acquire (&frame_lock);
+	list_push_back (&frame_table, &frame->elem);
+	lock_release (&frame_lock);
+	return frame;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it.  The frame comes back pinned; vm_do_claim_page()
+ * unpins it once the page is mapped.  Returns NULL only if the user
+ * pool is exhausted and nothing can be evicted. */
 static struct frame *
 vm_get_frame (void) {
-	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	struct frame *frame = frame_alloc ();
+
+	if (frame == NULL)
+		frame = vm_evict_frame ();
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+	ASSERT (frame == NULL || frame->page == NULL);
 	return frame;
 }
 
-/* Growing the stack. */
+/* Removes unused FRAME from the frame table and returns its memory to
+ * the user pool.  FRAME_LOCK must be held. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+frame_release (struct frame *frame) {
+	ASSERT (frame->ref_cnt == 0);
+
+	if (clock_hand == &frame->elem)
+		clock_hand = list_next (clock_hand);
+	list_remove (&frame->elem);
+	palloc_free_page (frame->kva);
+	free (frame);
+}
+
+/* Releases the frame of PAGE, if it has one: unmaps it from the
+ * owner's page table and, unless other processes still share it,
+ * returns the memory to the user pool.  Page types call this from
+ * their destroy handler. */
+void
+vm_frame_free (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame_settle (page);
+	frame = page->frame;
+	if (frame != NULL) {
+		if (page->owner->pml4 != NULL)
+			pml4_clear_page (page->owner->pml4, page->va);
+		frame_unlink (page);
+		if (frame->ref_cnt == 0)
+			frame_release (frame);
+	}
+	lock_release (&frame_lock);
+}
+
+/* Keeps PAGE's frame, if it has one, from being evicted, after
+ * waiting out an eviction already in progress, and returns its
+ * kernel address.  Returns NULL if PAGE is not resident.  For writing
+ * a page's contents out without FRAME_LOCK held; vm_frame_unpin()
+ * undoes it. */
+void *
+vm_frame_pin (struct page *page) {
+	void *kva = NULL;
+
+	lock_acquire (&frame_lock);
+	frame_settle (page);
+	if (page->frame != NULL) {
+		page->frame->pin_cnt++;
+		kva = page->frame->kva;
+	}
+	lock_release (&frame_lock);
+	return kva;
+}
+
+/* Undoes vm_frame_pin() on PAGE, which must have returned non-null. */
+void
+vm_frame_unpin (struct page *page) {
+	lock_acquire (&frame_lock);
+	ASSERT (page->frame != NULL && page->frame->pin_cnt > 0);
+	page->frame->pin_cnt--;
+	lock_release (&frame_lock);
+}
+
+/* Growing the stack.
+ * A fault at ADDR, below the stack, grows it if ADDR is no more than
+ * 8 bytes below the user stack pointer RSP (what PUSH touches) and
+ * within vm_stack_limit of USER_STACK.  The whole gap down to ADDR is
+ * added at once, so a large frame takes one fault, and up to
+ * STACK_PREFAULT_PAGES of the new pages are brought in right away
+ * from free frames.  Returns the page at ADDR, or NULL. */
+static struct page *
+vm_stack_growth (void *addr, uintptr_t rsp) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct spt_region *stack = spt_region_find (spt, (uint8_t *) USER_STACK - 1);
+	uint8_t *bottom = pg_round_down (addr);
+	uint8_t *old_bottom, *va;
+	size_t cnt;
+
+	if (stack == NULL || stack->type != REGION_STACK
+			|| (uintptr_t) addr + 8 < rsp
+			|| (uint8_t *) addr < (uint8_t *) USER_STACK - vm_stack_limit
+			|| bottom >= (uint8_t *) stack->start
+			|| spt_region_overlaps (spt, bottom, stack->start))
+		return NULL;
+
+	/* Grow one page at a time so that the region always covers
+	 * exactly the pages that exist. */
+	old_bottom = stack->start;
+	for (va = old_bottom - PGSIZE; va >= bottom; va -= PGSIZE) {
+		if (!vm_alloc_page (VM_ANON | VM_STACK, va, true))
+			return NULL;
+		stack->start = va;
+	}
+
+	/* The faulting page is claimed by the caller; bring in the rest
+	 * of the new stretch above it. */
+	for (va = bottom + PGSIZE, cnt = 1;
+			va < old_bottom && cnt < STACK_PREFAULT_PAGES; va += PGSIZE, cnt++)
+		if (!vm_prefetch_page (spt_find_page (spt, va)))
+			break;
+	return spt_find_page (spt, bottom);
 }
 
-/* Handle the fault on write_protected page */
+/* Returns the page of the running process at VA, growing the stack
+ * down to it if that is what an access there would do.  For system
+ * calls, which check user buffers before touching them. */
+struct page *
+vm_lookup_page (void *va) {
+	struct thread *t = thread_current ();
+	struct page *page = spt_find_page (&t->spt, va);
+
+	if (page == NULL && is_user_vaddr (va))
+		page = vm_stack_growth (va, t->user_rsp);
+	return page;
+}
+
+/* Handle the fault on write_protected page.
+ * PAGE is writable but its frame is mapped read-only because it was
+ * shared by fork.  If it is still shared, the page gets a private
+ * copy; if the other processes have let go of it, the mapping is just
+ * upgraded in place.  If the frame was evicted meanwhile, there is
+ * nothing to do: the retried access faults the page back in, private
+ * and writable. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	struct frame *frame, *copy = NULL;
+
+	for (;;) {
+		lock_acquire (&frame_lock);
+		frame_settle (page);
+		frame = page->frame;
+		if (frame == NULL || frame->ref_cnt == 1) {
+			bool ok = true;
+			if (frame != NULL && !page_is_writable (page)) {
+				ok = page_remap (page, frame->kva, true);
+				cow_upgraded_cnt++;
+			}
+			if (copy != NULL)
+				frame_release (copy);
+			lock_release (&frame_lock);
+			return ok;
+		}
+		if (copy != NULL)
+			break;
+
+		/* Getting a frame may evict, so do it unlocked and then look
+		 * again. */
+		lock_release (&frame_lock);
+		copy = vm_get_frame ();
+		if (copy == NULL)
+			return false;
+	}
+
+	memcpy (copy->kva, frame->kva, PGSIZE);
+	frame_unlink (page);
+	frame_link (copy, page);
+	if (!page_remap (page, copy->kva, true)) {
+		frame_unlink (page);
+		frame_release (copy);
+		lock_release (&frame_lock);
+		return false;
+	}
+	copy->pin_cnt--;
+	cow_copied_cnt++;
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Gets PAGE ready for the kernel to write to it on the process's
+ * behalf.  CR0.WP is clear, so a kernel write to a read-only shared
+ * frame would not fault; the page is brought in and made private
+ * here instead. */
+bool
+vm_prepare_write (struct page *page) {
+	ASSERT (page->writable);
+	return vm_do_claim_page (page) && vm_handle_wp (page);
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page;
+	bool first_touch;
 
-	return vm_do_claim_page (page);
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+
+	page = spt_find_page (spt, addr);
+	if (page == NULL)
+		page = vm_stack_growth (addr,
+				user ? f->rsp : thread_current ()->user_rsp);
+	if (page == NULL || (write && !page->writable))
+		return false;
+	if (!not_present) {
+		if (!write)
+			return false;
+		/* Either the zero page or a frame shared by fork. */
+		return page->frame == NULL ? vm_do_claim_page (page)
+			: vm_handle_wp (page);
+	}
+	if (!write && is_zero_fill (page)) {
+		if (!pml4_set_page (page->owner->pml4, page->va, zero_page, false))
+			return false;
+		zero_map_cnt++;
+		return true;
+	}
+
+	first_touch = VM_TYPE (page->operations->type) == VM_UNINIT;
+	if (!vm_do_claim_page (page))
+		return false;
+	if (page_get_type (page) == VM_FILE)
+		vm_file_readahead (page);
+	else if (first_touch)
+		vm_fault_around (spt, page);
+	return true;
+}
+
+/* After a first-touch fault on a segment page, loads the other
+ * untouched pages of the same FAULT_AROUND_PAGES-aligned window of
+ * that segment, so that a program walking through its text and data
+ * takes one fault per window instead of one per page.  Only free
+ * frames are used; neighbours are never worth an eviction. */
+static void
+vm_fault_around (struct supplemental_page_table *spt, struct page *page) {
+	struct spt_region *region = spt_region_find (spt, page->va);
+	uint8_t *start, *end, *va;
+
+	if (region == NULL || region->type != REGION_SEGMENT)
+		return;
+
+	start = (uint8_t *) ((uintptr_t) page->va
+			& ~((uintptr_t) FAULT_AROUND_PAGES * PGSIZE - 1));
+	end = start + FAULT_AROUND_PAGES * PGSIZE;
+	if (start < (uint8_t *) region->start)
+		start = region->start;
+	if (end > (uint8_t *) region->end)
+		end = region->end;
+
+	for (va = start; va < end; va += PGSIZE) {
+		struct page *p = spt_find_page (spt, va);
+
+		if (p == NULL || p->frame != NULL
+				|| VM_TYPE (p->operations->type) != VM_UNINIT
+				|| is_zero_fill (p))
+			continue;
+		if (!vm_prefetch_page (p))
+			break;
+	}
 }
 
 /* Free the page.
@@ -150,41 +948,286 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
-/* Claim the PAGE and set up the mmu. */
+/* Brings PAGE in ahead of use, but only into a free frame: this
+ * never evicts.  The page is mapped with its accessed bit clear, so
+ * if it is not touched soon it is the first to go again. */
+bool
+vm_prefetch_page (struct page *page) {
+	struct frame *frame;
+
+	if (page->frame != NULL)
+		return true;
+
+	frame = frame_alloc ();
+	if (frame == NULL)
+		return false;
+	if (!vm_install_frame (page, frame))
+		return false;
+	pml4_set_accessed (page->owner->pml4, page->va, false);
+	return true;
+}
+
+/* Claim the PAGE and set up the mmu.  The contents are brought in
+ * before the mapping is installed, so the process never sees a
+ * half-filled page. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame_settle (page);
+	frame = page->frame;
+	lock_release (&frame_lock);
+	if (frame != NULL)
+		return true;
+
+	frame = vm_get_frame ();
+	if (frame == NULL)
+		return false;
+	return vm_install_frame (page, frame);
+}
+
+/* Links pinned FRAME to PAGE, fills it and maps it, then unpins it.
+ * On failure the frame is released. */
+static bool
+vm_install_frame (struct page *page, struct frame *frame) {
+	/* Drop a zero page mapping first: pml4_set_page() does not flush
+	 * the TLB, and with CR0.WP clear a stale read-only entry would let
+	 * the kernel write into the zero page. */
+	if (page->frame == NULL
+			&& pml4_get_page (page->owner->pml4, page->va) == zero_page) {
+		pml4_clear_page (page->owner->pml4, page->va);
+		zero_break_cnt++;
+	}
 
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	lock_acquire (&frame_lock);
+	frame_link (frame, page);
+	lock_release (&frame_lock);
+
+	if (!swap_in (page, frame->kva)
+			|| !pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable)) {
+		vm_frame_free (page);
+		return false;
+	}
+	lock_acquire (&frame_lock);
+	frame->pin_cnt--;
+	lock_release (&frame_lock);
+	return true;
+}
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+/* Returns a hash value for the page that E is embedded in. */
+static uint64_t
+page_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page *page = hash_entry (e, struct page, spt_elem);
+	return hash_bytes (&page->va, sizeof page->va);
+}
 
-	return swap_in (page, frame->kva);
+/* Orders pages by user virtual address. */
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct page, spt_elem)->va
+		< hash_entry (b, struct page, spt_elem)->va;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	hash_init (&spt->pages, page_hash, page_less, NULL);
+	spt->regions = NULL;
+	spt->region_cnt = spt->region_cap = 0;
+	spt->rss = spt->shared = spt->swapped = 0;
+	spt->ws = spt->ws_seen = spt->ws_hits = 0;
+
+	lock_acquire (&frame_lock);
+	list_push_back (&proc_list, &spt->elem);
+	spt->listed = true;
+	lock_release (&frame_lock);
+}
+
+/* Gives the running process, whose table is DST, a copy-on-write
+ * copy of SRC, a page of its parent.  A resident frame is shared and
+ * both mappings become read-only; a swapped-out anonymous page shares
+ * the slot; everything else is recreated as a fresh uninit page, so
+ * nothing is read or copied now. */
+static bool
+spt_copy_page (struct supplemental_page_table *dst, struct page *src) {
+	enum vm_type type = VM_TYPE (src->operations->type);
+	struct thread *child = thread_current ();
+	struct page *page;
+	bool ok = true;
+
+	if (type == VM_UNINIT) {
+		/* Initializers of forkable pages find their data through the
+		 * region, so there is no AUX to duplicate. */
+		ASSERT (src->uninit.aux == NULL);
+		return vm_alloc_page_with_initializer (src->uninit.type, src->va,
+				src->writable, src->uninit.init, NULL);
+	}
+
+	page = malloc (sizeof *page);
+	if (page == NULL)
+		return false;
+
+	lock_acquire (&frame_lock);
+	frame_settle (src);
+	*page = *src;
+	page->owner = child;
+	page->frame = NULL;
+	if (type == VM_FILE)
+		page->file.map = spt_region_find (dst, page->va)->aux;
+
+	if (src->frame != NULL) {
+		struct frame *frame = src->frame;
+
+		if (src->writable && page_is_writable (src))
+			ok = page_remap (src, frame->kva, false);
+		frame_link (frame, page);
+		if (!ok || !pml4_set_page (child->pml4, page->va, frame->kva, false)) {
+			frame_unlink (page);
+			ok = false;
+		}
+	} else if (type == VM_ANON && anon_is_swapped (src))
+		anon_share_slot (src, page);
+	else {
+		lock_release (&frame_lock);
+		free (page);
+		return vm_alloc_page (type, src->va, src->writable);
+	}
+	if (ok)
+		cow_shared_cnt++;
+	lock_release (&frame_lock);
+
+	if (!ok || !spt_insert_page (dst, page)) {
+		vm_dealloc_page (page);
+		return false;
+	}
+	return true;
+}
+
+/* Copy supplemental page table from src to dst.
+ * Runs in the child.  Regions come first, since file pages look
+ * their mapping up in them; then every page is shared with the
+ * parent copy-on-write (see spt_copy_page()). */
+bool
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct hash_iterator i;
+
+	dst->rss_limit = src->rss_limit;
+	for (size_t r = 0; r < src->region_cnt; r++) {
+		const struct spt_region *s = &src->regions[r];
+		struct spt_region *d;
+
+		if (s->type == REGION_MMAP) {
+			if (!mmap_copy_region (dst, s))
+				return false;
+			continue;
+		}
+		d = spt_region_insert (dst, s->start, s->end, s->type, s->aux);
+		if (d == NULL)
+			return false;
+		d->ofs = s->ofs;
+		d->file_bytes = s->file_bytes;
+	}
+
+	cow_fork_cnt++;
+	hash_first (&i, &src->pages);
+	while (hash_next (&i))
+		if (!spt_copy_page (dst, hash_entry (hash_cur (&i), struct page,
+						spt_elem)))
+			return false;
+	return true;
+}
+
+/* hash_destroy() action that frees one page of a dying table. */
+static void
+spt_destroy_page (struct hash_elem *e, void *aux UNUSED) {
+	vm_dealloc_page (hash_entry (e, struct page, spt_elem));
+}
+
+/* Free the resource hold by the supplemental page table.
+ * SPT must be initialized again before it is reused. */
+void
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	size_t i;
+
+	/* Unmap mappings first, while their pages still exist, so that
+	 * each one's dirty pages are written back and its file closed. */
+	for (i = spt->region_cnt; i-- > 0; )
+		if (spt->regions[i].type == REGION_MMAP)
+			do_munmap (spt->regions[i].start);
+	hash_destroy (&spt->pages, spt_destroy_page);
+	free (spt->regions);
+	spt->regions = NULL;
+	spt->region_cnt = spt->region_cap = 0;
+
+	/* Threads that never ran a user program were never listed. */
+	lock_acquire (&frame_lock);
+	if (spt->listed) {
+		list_remove (&spt->elem);
+		spt->listed = false;
+	}
+	lock_release (&frame_lock);
 }
 
-/* Copy supplemental page table from src to dst */
+/* Stores the memory usage of process PID in *STAT.  Returns false if
+ * there is no such process. */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+vm_memstat (int pid, struct vm_memstat *stat) {
+	bool found = false;
+
+	lock_acquire (&frame_lock);
+	for (struct list_elem *e = list_begin (&proc_list);
+			e != list_end (&proc_list); e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, spt.elem);
+		if (t->tid != pid)
+			continue;
+		stat->rss = t->spt.rss;
+		stat->swapped = t->spt.swapped;
+		stat->shared = t->spt.shared;
+		stat->ws = t->spt.ws;
+		stat->rss_limit = rss_limit (&t->spt);
+		found = true;
+		break;
+	}
+	lock_release (&frame_lock);
+	return found;
+}
+
+/* Sets the running process's resident set soft limit to PAGES, or
+ * back to the default if PAGES is 0, and returns the old limit.
+ * Going over the limit does not fail anything: it only makes the
+ * process's frames the first choice for eviction. */
+size_t
+vm_set_rss_limit (size_t pages) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	size_t old;
+
+	lock_acquire (&frame_lock);
+	old = rss_limit (spt);
+	rss_set (spt, spt->rss, pages);
+	lock_release (&frame_lock);
+	return old;
 }
 
-/* Free the resource hold by the supplemental page table */
+/* Prints copy-on-write fork and zero page statistics. */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+vm_print_stats (void) {
+	printf ("COW: %lld forks, %lld pages shared, %lld copied, %lld upgraded\n",
+			cow_fork_cnt, cow_shared_cnt, cow_copied_cnt, cow_upgraded_cnt);
+	printf ("Zero page: %lld read faults mapped, %lld later written\n",
+			zero_map_cnt, zero_break_cnt);
+	printf ("RSS limit: %lld evictions from processes over their limit\n",
+			rss_limit_evict_cnt);
 }